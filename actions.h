@@ -8,7 +8,7 @@ namespace clang
 {
 namespace tooling
 {
-class ClangTool;
+class CompilationDatabase;
 }
 } // namespace clang
 
@@ -16,10 +16,85 @@ namespace goby
 {
 namespace clang
 {
-int generate(::clang::tooling::ClangTool& Tool, std::string output_directory,
-             std::string output_file, std::string target_name);
+// settings for the 'gen' action (all but the blocking call settings only affect performance)
+struct GenerateOptions
+{
+    // number of translation units to parse concurrently (0 for one per hardware thread)
+    unsigned jobs{1};
+    // skip translation units whose source text shows they can't call publish or subscribe
+    bool prefilter{true};
+    // directory of cached per-translation unit results (empty to always parse everything)
+    std::string cache_directory;
+    // directory of precompiled preambles of common headers (empty to parse them in every unit)
+    std::string pch_directory;
+    // headers to precompile (defaults to the goby transporter headers if empty)
+    std::vector<std::string> pch_headers;
+    // print the time spent in each AST matcher
+    bool match_profile{false};
+    // print the work saved by the prefilter, cache, reused function bodies and preambles
+    bool stats{false};
+    // qualified names (without template arguments) of the functions, or classes for all their
+    // members, whose calls in a subscribe callback are reported as blocking (defaults to sleeps,
+    // file and socket I/O, mutex locks and synchronous boost::asio calls if empty). Names without
+    // "::" (e.g. "read") only match functions declared in system headers
+    std::vector<std::string> blocking_apis;
+    // how many calls deep to follow the functions called by a subscribe callback looking for
+    // blocking calls
+    int blocking_depth{4};
+};
+
+// settings for the 'viz' action
+struct VisualizeOptions
+{
+    // do not draw publishers without subscribers or subscribers without publishers
+    bool omit_disconnected{false};
+    // number of interface files to load (and shards to write) concurrently (0 for one per
+    // hardware thread)
+    unsigned jobs{0};
+    // write each platform to its own file, leaving only the intervehicle connections in the
+    // main output file
+    bool shard{false};
+    // draw one representative of each set of platforms with identical applications and of each
+    // set of thread instantiations that differ only by integer template arguments
+    bool collapse{false};
+    // keep running, writing the output again whenever the deployment or interface files change
+    // (only the changed applications are parsed and written again; nothing is cached between runs)
+    bool watch{false};
+    // print the bytes per second of the intervehicle DCCL publications over each
+    // platform-to-platform link
+    bool bandwidth_report{false};
+    // shared libraries of DCCL messages (and codecs) for the message sizes of the report
+    std::vector<std::string> dccl_libraries;
+    // capacity of each intervehicle link for the report (bits per second; 0 if unknown)
+    double link_capacity{0};
+    // print the interthread publish() and subscribe() calls that copy the data, ranked by the
+    // bytes per second copied
+    bool copy_report{false};
+    // YAML file of publication rates (Hz) by group ("rates: {group: hz}"), used instead of the
+    // rates estimated from the interface files
+    std::string rates_file;
+};
+
+int generate(const ::clang::tooling::CompilationDatabase& compilations,
+             const std::vector<std::string>& sources, std::string output_directory,
+             std::string output_file, std::string target_name, const GenerateOptions& options);
+// as generate() for every target in the mapping files (YAML: "targets: [{name, sources: []}]"),
+// parsing each source once and writing {target}_interface.yml for each
+int generate_batch(const ::clang::tooling::CompilationDatabase& compilations,
+                   const std::vector<std::string>& mapping_files, std::string output_directory,
+                   const GenerateOptions& options);
+// as generate(), but write the results of each source to its own interface fragment file
+// ({source path relative to the current directory}.interface_fragment.yml in output_directory,
+// creating its subdirectories, unless output_file is given for a single source)
+int generate_fragments(const ::clang::tooling::CompilationDatabase& compilations,
+                       const std::vector<std::string>& sources, std::string output_directory,
+                       std::string output_file, const GenerateOptions& options);
+// combine the fragments written by generate_fragments() into the interface file of target_name
+int merge(const std::vector<std::string>& fragment_files, std::string output_directory,
+          std::string output_file, std::string target_name);
 int visualize(const std::vector<std::string>& ymls, std::string output_directory,
-              std::string output_file, std::string deployment_name, bool omit_disconnected);
+              std::string output_file, std::string deployment_name,
+              const VisualizeOptions& options);
 } // namespace clang
 } // namespace goby
 
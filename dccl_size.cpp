@@ -0,0 +1,64 @@
+#include <cstdlib>
+#include <iostream>
+
+#include <boost/algorithm/string.hpp>
+#include <dccl/codec.h>
+#include <dccl/dynamic_protobuf_manager.h>
+
+#include "dccl_size.h"
+
+goby::clang::DcclSizes::DcclSizes(const std::vector<std::string>& libraries)
+    : codec_(new dccl::Codec)
+{
+    for (const auto& library : libraries)
+    {
+        try
+        {
+            codec_->load_library(library);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Failed to load DCCL library " << library << ": " << e.what()
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+goby::clang::DcclSizes::~DcclSizes() = default;
+
+int goby::clang::DcclSizes::max_size(const std::string& type, std::string& error)
+{
+    auto it = sizes_.find(type);
+    if (it == sizes_.end())
+    {
+        Size size{-1, std::string()};
+
+        // C++ type name to Protobuf full name
+        std::string full_name = boost::algorithm::replace_all_copy(type, "::", ".");
+        if (!full_name.empty() && full_name.front() == '.')
+            full_name.erase(0, 1);
+
+        const auto* descriptor = dccl::DynamicProtobufManager::find_descriptor(full_name);
+        if (!descriptor)
+        {
+            size.error = "no descriptor for " + full_name + " (missing -dccl-lib?)";
+        }
+        else
+        {
+            try
+            {
+                codec_->load(descriptor);
+                size.bytes = codec_->max_size(descriptor);
+            }
+            catch (const std::exception& e)
+            {
+                size.error = full_name + " is not a valid DCCL message: " + e.what();
+            }
+        }
+        it = sizes_.emplace(type, size).first;
+    }
+
+    error = it->second.error;
+    return it->second.bytes;
+}
@@ -0,0 +1,46 @@
+#ifndef DCCL_SIZE_20191215H
+#define DCCL_SIZE_20191215H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dccl
+{
+class Codec;
+}
+
+namespace goby
+{
+namespace clang
+{
+// Maximum encoded sizes of DCCL messages, from the message descriptors compiled into goby and into
+// the given shared libraries (which are loaded as by "dccl -l", so they may also register custom
+// field codecs)
+class DcclSizes
+{
+  public:
+    // exits if a library can't be loaded
+    explicit DcclSizes(const std::vector<std::string>& libraries);
+    ~DcclSizes();
+
+    // maximum encoded size in bytes of the message with C++ type name type (as written by -gen,
+    // e.g. "goby::middleware::protobuf::NavigationReport"), or -1 with the reason in error
+    int max_size(const std::string& type, std::string& error);
+
+  private:
+    std::unique_ptr<dccl::Codec> codec_;
+
+    struct Size
+    {
+        int bytes;
+        std::string error;
+    };
+    // memoized by type
+    std::map<std::string, Size> sizes_;
+};
+} // namespace clang
+} // namespace goby
+
+#endif
@@ -1,53 +1,125 @@
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #include "yaml_raii.h"
 #include <yaml-cpp/yaml.h>
 
 #include "goby/middleware/marshalling/interface.h"
 
+#include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
+#include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Index/USRGeneration.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/VirtualFileSystem.h"
 
 #include "actions.h"
+#include "interface_fragment.h"
+#include "precompiled_preamble.h"
+#include "prefilter.h"
 #include "pubsub_entry.h"
+#include "tu_cache.h"
 
+using goby::clang::InterfaceFragment;
 using goby::clang::Layer;
 using goby::clang::PubSubEntry;
 
-std::map<Layer, std::string> layer_to_str{{Layer::UNKNOWN, "unknown"},
-                                          {Layer::INTERTHREAD, "interthread"},
-                                          {Layer::INTERPROCESS, "interprocess"},
-                                          {Layer::INTERVEHICLE, "intervehicle"}};
+namespace
+{
+// Memoized isDerivedFrom() for one goby base class: the same few records (threads, transporters)
+// are checked for nearly every member call
+class DerivationCache
+{
+  public:
+    DerivationCache(std::string base) : base_(base) {}
+
+    bool is_derived(const clang::CXXRecordDecl* record)
+    {
+        record = record ? record->getDefinition() : nullptr;
+        if (!record)
+            return false;
+
+        auto it = derived_.find(record);
+        if (it != derived_.end())
+            return it->second;
+
+        // not derived from itself (as with isDerivedFrom()); also guards against recursion
+        derived_[record] = false;
+        bool derived = false;
+        for (const auto& base : record->bases())
+        {
+            const auto* base_record = base.getType()->getAsCXXRecordDecl();
+            if (base_record && (base_record->getQualifiedNameAsString() == base_ ||
+                                is_derived(base_record)))
+            {
+                derived = true;
+                break;
+            }
+        }
+        derived_[record] = derived;
+        return derived;
+    }
+
+    // declarations are only valid within a single translation unit
+    void clear() { derived_.clear(); }
+
+  private:
+    std::string base_;
+    std::unordered_map<const clang::CXXRecordDecl*, bool> derived_;
+};
 
-::clang::ast_matchers::StatementMatcher pubsub_matcher(const char* method)
+AST_MATCHER_P(clang::CXXRecordDecl, isDerivedFromCached, std::shared_ptr<DerivationCache>,
+              cache)
+{
+    return cache->is_derived(&Node);
+}
+
+// loc (an expansion location) is in a system header or in goby's own transporter and thread
+// headers, which only publish and subscribe on goby's internal groups. The exception is goby's I/O
+// thread templates, which publish and subscribe on the user groups they are instantiated with.
+bool is_outside_project_code(clang::SourceLocation loc, const clang::SourceManager& source_manager)
+{
+    if (loc.isInvalid())
+        return false;
+    std::string file = source_manager.getFilename(loc).str();
+    return (source_manager.isInSystemHeader(loc) ||
+            goby::clang::is_goby_middleware_header(file)) &&
+           !goby::clang::is_goby_io_thread_header(file);
+}
+
+AST_MATCHER(clang::Stmt, isExpansionOutsideProjectCode)
+{
+    const auto& source_manager = Finder->getASTContext().getSourceManager();
+    return is_outside_project_code(source_manager.getExpansionLoc(Node.getBeginLoc()),
+                                   source_manager);
+}
+} // namespace
+
+::clang::ast_matchers::StatementMatcher
+pubsub_matcher(std::shared_ptr<DerivationCache> transporter_cache)
 {
     using namespace clang::ast_matchers;
     return cxxMemberCallExpr(
         expr().bind("pubsub_call_expr"),
-        // call is on an instantiation of a class derived from StaticTransporterInterface
-        on(expr(
-            anyOf(
-                // Thread: pull out what "this" in "this->interprocess()" when "this" is derived from goby::middleware::Thread
-                cxxMemberCallExpr(on(hasType(pointsTo(cxxRecordDecl(
-                    cxxRecordDecl().bind("on_thread_decl"),
-                    isDerivedFrom(cxxRecordDecl(hasName("::goby::middleware::Thread")))))))),
-                // Thread: match this->goby().interprocess() or similar chains
-                hasDescendant(cxxMemberCallExpr(on(hasType(pointsTo(cxxRecordDecl(
-                    cxxRecordDecl().bind("on_indirect_thread_decl"),
-                    isDerivedFrom(cxxRecordDecl(hasName("::goby::middleware::Thread"))))))))),
-                // also allow out direct calls to publish/subscribe
-                expr().bind("on_expr")),
-            hasType(cxxRecordDecl(decl().bind("on_type_decl"),
-                                  isDerivedFrom(cxxRecordDecl(
-                                      hasName("::goby::middleware::StaticTransporterInterface"))),
-                                  unless(hasName("::goby::middleware::NullTransporter")))))),
+        // only calls in project code and goby's I/O threads (checked first)
+        unless(isExpansionOutsideProjectCode()),
         callee(cxxMethodDecl(
+            cxxMethodDecl().bind("pubsub_method"),
             // "publish" or "subscribe"
-            hasName(method),
+            hasAnyName("publish", "subscribe"),
             // Group (must refer to goby::middleware::Group)
             hasTemplateArgument(0, templateArgument(refersToDeclaration(varDecl(
                                        hasType(cxxRecordDecl(hasName("::goby::middleware::Group"))),
@@ -59,32 +131,61 @@ std::map<Layer, std::string> layer_to_str{{Layer::UNKNOWN, "unknown"},
             // Scheme (must be int)
             hasTemplateArgument(
                 2, templateArgument(templateArgument().bind("scheme_arg"),
-                                    refersToIntegralType(qualType(asString("int"))))))));
+                                    refersToIntegralType(qualType(asString("int"))))))),
+        // call is on an instantiation of a class derived from StaticTransporterInterface
+        // (the calling thread, if any, is found by PubSubAggregator)
+        on(expr(expr().bind("on_expr"),
+                hasType(cxxRecordDecl(
+                    decl().bind("on_type_decl"),
+                    isDerivedFromCached(transporter_cache),
+                    unless(hasName("::goby::middleware::NullTransporter")))))));
 }
 
 class PubSubAggregator : public ::clang::ast_matchers::MatchFinder::MatchCallback
 {
   public:
+    // blocking_apis and blocking_depth as in GenerateOptions
+    PubSubAggregator(std::vector<std::string> blocking_apis, int blocking_depth)
+        : transporter_cache_(
+              std::make_shared<DerivationCache>("goby::middleware::StaticTransporterInterface")),
+          thread_cache_("goby::middleware::Thread"),
+          blocking_apis_(std::move(blocking_apis)),
+          blocking_depth_(blocking_depth)
+    {
+    }
+
+    llvm::StringRef getID() const override { return "pubsub_matcher"; }
+
+    // (MatchFinder::match() does not call onStartOfTranslationUnit())
+    void start_translation_unit()
+    {
+        transporter_cache_->clear();
+        thread_cache_.clear();
+        type_strings_.clear();
+        thread_info_.clear();
+        blocking_calls_.clear();
+    }
+
     virtual void run(const ::clang::ast_matchers::MatchFinder::MatchResult& Result)
     {
         // the function call itself (e.g. interprocess().publish<...>(...));
         const auto* pubsub_call_expr =
             Result.Nodes.getNodeAs<clang::CXXMemberCallExpr>("pubsub_call_expr");
 
+        const auto* pubsub_method = Result.Nodes.getNodeAs<clang::CXXMethodDecl>("pubsub_method");
         const auto* group_string_lit =
             Result.Nodes.getNodeAs<clang::StringLiteral>("group_string_arg");
         const auto* type_arg = Result.Nodes.getNodeAs<clang::TemplateArgument>("type_arg");
         const auto* scheme_arg = Result.Nodes.getNodeAs<clang::TemplateArgument>("scheme_arg");
         const auto* on_type_decl = Result.Nodes.getNodeAs<clang::CXXRecordDecl>("on_type_decl");
-        const auto* on_thread_decl = Result.Nodes.getNodeAs<clang::CXXRecordDecl>("on_thread_decl");
+        const auto* on_expr = Result.Nodes.getNodeAs<clang::Expr>("on_expr");
 
-        if (!on_thread_decl)
-            on_thread_decl =
-                Result.Nodes.getNodeAs<clang::CXXRecordDecl>("on_indirect_thread_decl");
-
-        if (!pubsub_call_expr || !group_string_lit || !type_arg || !scheme_arg || !on_type_decl)
+        if (!pubsub_call_expr || !pubsub_method || !group_string_lit || !type_arg ||
+            !scheme_arg || !on_type_decl || !on_expr)
             return;
 
+        const clang::CXXRecordDecl* on_thread_decl = find_thread(on_expr);
+
         const std::string layer_type = on_type_decl->getQualifiedNameAsString();
         Layer layer = Layer::UNKNOWN;
 
@@ -95,19 +196,20 @@ class PubSubAggregator : public ::clang::ast_matchers::MatchFinder::MatchCallbac
         else if (layer_type.find("InterVehicle") != std::string::npos)
             layer = Layer::INTERVEHICLE;
 
-        std::string thread = "unknown";
-        std::set<std::string> bases;
+        static const std::string unknown_thread("unknown");
+        static const std::set<std::string> no_bases;
+        const std::string* thread = &unknown_thread;
+        const std::set<std::string>* bases = &no_bases;
         if (on_thread_decl)
         {
-            thread = as_string(*on_thread_decl);
-            for (auto it = on_thread_decl->bases_begin(), end = on_thread_decl->bases_end();
-                 it != end; ++it)
-                bases.insert(as_string(*(it->getType()->getAsCXXRecordDecl())));
+            const auto& info = thread_info(*on_thread_decl);
+            thread = &info.name;
+            bases = &info.bases;
         }
-        bases_[thread] = bases;
+        bases_.emplace(*thread, *bases);
 
         const std::string group = group_string_lit->getString().str();
-        const std::string type = as_string(*type_arg->getAsType());
+        const std::string& type = as_string(*type_arg->getAsType());
         const int scheme_num = scheme_arg->getAsIntegral().getExtValue();
         const std::string scheme = goby::middleware::MarshallingScheme::to_string(scheme_num);
 
@@ -115,17 +217,620 @@ class PubSubAggregator : public ::clang::ast_matchers::MatchFinder::MatchCallbac
         if (group.find("goby::") != std::string::npos)
             return;
 
-        entries_.emplace(layer, thread, group, scheme, type);
+        const bool is_publish = pubsub_method->getName() == "publish";
+        const std::string site = call_site(*pubsub_call_expr, *Result.SourceManager);
+        PubSubEntry entry(layer, *thread, group, scheme, type);
+        if (is_publish)
+            entry.rates.emplace(site, rate_expression(*pubsub_call_expr));
+
+        // interthread data is passed by shared_ptr, so a copy is avoidable
+        if (layer == Layer::INTERTHREAD)
+        {
+            entry.size = type_size(type_arg->getAsType(), *Result.Context);
+            if (copies_data(*pubsub_call_expr, *pubsub_method, is_publish))
+                entry.copies.insert(site);
+        }
+
+        if (!is_publish && pubsub_call_expr->getNumArgs() > 0)
+        {
+            bool bound;
+            const auto* callback = callback_function(pubsub_call_expr->getArg(0), bound);
+            if (callback)
+            {
+                for (const auto& hazard :
+                     blocking_calls(*callback, blocking_depth_, *Result.SourceManager))
+                    entry.blocking.insert("subscribe (" + site + ") -> " + hazard.chain);
+            }
+        }
+
+        static const std::string cxx_object_scheme("CXX_OBJECT");
+        if (scheme == cxx_object_scheme && !types_.count(type))
+        {
+            goby::clang::TypeLayout layout;
+            if (record_layout(type_arg->getAsType(), *Result.Context, layout))
+                types_.emplace(type, layout);
+        }
+
+        goby::clang::insert_merged(is_publish ? publishes_ : subscribes_, entry);
+    }
+
+    // the function whose body (and constructor initializers) are being matched, if any
+    void set_function(const clang::FunctionDecl* function) { function_ = function; }
+
+    const std::shared_ptr<DerivationCache>& transporter_cache() { return transporter_cache_; }
+
+    // move the results into fragment, leaving the aggregator empty for the next translation unit
+    void take(InterfaceFragment& fragment)
+    {
+        fragment.publishes = std::move(publishes_);
+        fragment.subscribes = std::move(subscribes_);
+        fragment.bases = std::move(bases_);
+        fragment.types = std::move(types_);
+        publishes_.clear();
+        subscribes_.clear();
+        bases_.clear();
+        types_.clear();
+    }
+
+  private:
+    // "file:line:column" of the call, with the file made absolute so that it is the same from
+    // every translation unit
+    std::string call_site(const clang::Stmt& call, const clang::SourceManager& source_manager)
+    {
+        auto loc =
+            source_manager.getPresumedLoc(source_manager.getExpansionLoc(call.getBeginLoc()));
+        if (loc.isInvalid())
+            return "unknown";
+
+        llvm::SmallString<256> path(loc.getFilename());
+        source_manager.getFileManager().makeAbsolutePath(path);
+        llvm::sys::path::remove_dots(path, true);
+        return path.str().str() + ":" + std::to_string(loc.getLine()) + ":" +
+               std::to_string(loc.getColumn());
+    }
+
+    // How often a publish() call is made, as an expression for -viz: the loop frequency (Hz) in
+    // loop() of a thread constructed with a constant one, "rate(group)" in a lambda passed to
+    // subscribe<group>(), "once" in a constructor and "?" otherwise; prefixed with "N*" for each
+    // for, while or do loop around the call
+    std::string rate_expression(const clang::Stmt& call)
+    {
+        std::vector<const clang::Stmt*> path;
+        if (function_ && !find_path(function_->getBody(), &call, path))
+            path.clear();
+
+        std::string loops;
+        for (auto it = path.rbegin(), end = path.rend(); it != end; ++it)
+        {
+            const auto* stmt = *it;
+            if (llvm::isa<clang::ForStmt>(stmt) || llvm::isa<clang::WhileStmt>(stmt) ||
+                llvm::isa<clang::DoStmt>(stmt) || llvm::isa<clang::CXXForRangeStmt>(stmt))
+                loops += "N*";
+
+            if (llvm::isa<clang::LambdaExpr>(stmt))
+            {
+                auto group = subscribe_group(std::next(it), end);
+                return loops + (group.empty() ? "?" : "rate(" + group + ")");
+            }
+        }
+
+        if (llvm::isa_and_nonnull<clang::CXXConstructorDecl>(function_))
+            return loops + "once";
+
+        const auto* method = llvm::dyn_cast_or_null<clang::CXXMethodDecl>(function_);
+        if (method && method->getIdentifier() && method->getName() == "loop" &&
+            method->getNumParams() == 0)
+        {
+            auto frequency = loop_frequency(*method->getParent());
+            if (!frequency.empty())
+                return loops + frequency;
+        }
+        return loops + "?";
+    }
+
+    // the layout of type if it is a complete class (see TypeLayout)
+    static bool record_layout(clang::QualType type, const clang::ASTContext& context,
+                              goby::clang::TypeLayout& layout)
+    {
+        const auto* record = type.isNull() ? nullptr : type->getAsCXXRecordDecl();
+        record = record ? record->getDefinition() : nullptr;
+        if (!record || record->isDependentType() || record->isInvalidDecl())
+            return false;
+
+        const auto& record_layout = context.getASTRecordLayout(record);
+        layout.size = record_layout.getSize().getQuantity();
+        layout.align = record_layout.getAlignment().getQuantity();
+
+        // bits used by the vtable pointer, bases and members
+        long used_bits = 0;
+        if (record->isDynamicClass() && !record_layout.getPrimaryBase())
+            used_bits += context.getTypeSize(context.VoidPtrTy);
+        for (const auto& base : record->bases())
+        {
+            const auto* base_record = base.getType()->getAsCXXRecordDecl();
+            if (base_record && !base.isVirtual())
+                used_bits += context.toBits(
+                    context.getASTRecordLayout(base_record->getDefinition()).getDataSize());
+        }
+
+        // byte ranges of each member
+        struct Member
+        {
+            std::string name;
+            long begin;
+            long end;
+            bool atomic;
+        };
+        std::vector<Member> members;
+        for (const auto* field : record->fields())
+        {
+            long offset_bits = record_layout.getFieldOffset(field->getFieldIndex());
+            long size_bits = field->isBitField() ? field->getBitWidthValue(context)
+                                                 : context.getTypeSize(field->getType());
+            used_bits += size_bits;
+            if (size_bits == 0)
+                continue;
+
+            const auto* field_record = field->getType()->getAsCXXRecordDecl();
+            bool atomic = field->getType()->isAtomicType() ||
+                          (field_record && field_record->isInStdNamespace() &&
+                           field_record->getIdentifier() && field_record->getName() == "atomic");
+            long begin = offset_bits / 8, end = (offset_bits + size_bits + 7) / 8;
+            members.push_back({field->getNameAsString(), begin, end, atomic});
+
+            const auto line = goby::clang::cache_line_size;
+            if (end - begin <= line && begin / line != (end - 1) / line)
+                layout.straddling.push_back(field->getNameAsString());
+            if (!field->getType().isTriviallyCopyableType(context))
+                layout.non_trivially_copyable.push_back(field->getNameAsString() + " (" +
+                                                        field->getType().getAsString() + ")");
+        }
+        layout.padding = std::max(0L, layout.size - used_bits / 8);
+
+        for (const auto& atomic : members)
+        {
+            if (!atomic.atomic)
+                continue;
+            std::string sharing;
+            for (const auto& other : members)
+            {
+                const auto line = goby::clang::cache_line_size;
+                bool same_line = other.begin / line <= (atomic.end - 1) / line &&
+                                 atomic.begin / line <= (other.end - 1) / line;
+                if (&other != &atomic && !other.atomic && same_line)
+                    sharing += (sharing.empty() ? "" : ", ") + other.name;
+            }
+            if (!sharing.empty())
+                layout.shared_atomics.push_back(atomic.name + " (with " + sharing + ")");
+        }
+        return true;
+    }
+
+    // sizeof(type) in bytes, or -1 if it can't be known here
+    static long type_size(clang::QualType type, const clang::ASTContext& context)
+    {
+        if (type.isNull() || type->isDependentType() || type->isIncompleteType() ||
+            type->isUndeducedType())
+            return -1;
+        return context.getTypeSizeInChars(type).getQuantity();
+    }
+
+    static bool is_shared_ptr(clang::QualType type)
+    {
+        const auto* record = type.getNonReferenceType()->getAsCXXRecordDecl();
+        return record && record->isInStdNamespace() && record->getIdentifier() &&
+               record->getName() == "shared_ptr";
+    }
+
+    // whether the call copies the data: publish(const Data&) copies it into a new shared_ptr and
+    // a subscribe() callback (a lambda or function) taking Data by value copies each message
+    static bool copies_data(const clang::CXXMemberCallExpr& call,
+                            const clang::CXXMethodDecl& method, bool is_publish)
+    {
+        if (is_publish)
+            return method.getNumParams() > 0 && !is_shared_ptr(method.getParamDecl(0)->getType());
+
+        if (call.getNumArgs() == 0)
+            return false;
+        bool bound;
+        const auto* callback = callback_function(call.getArg(0), bound);
+        // the data is only known to be the first parameter of a bound function if it is the only
+        // one (as in std::bind(&Thread::handle, this, _1))
+        if (!callback || callback->getNumParams() == 0 || (bound && callback->getNumParams() != 1))
+            return false;
+        auto type = callback->getParamDecl(0)->getType();
+        return !type->isDependentType() && !type->isReferenceType() && !type->isPointerType() &&
+               !is_shared_ptr(type);
+    }
+
+    // the function called by a callback expression: a lambda, function (or member function
+    // passed to std::bind, setting bound) or variable initialized with one, through the
+    // std::function construction (nullptr for anything else)
+    static const clang::FunctionDecl* callback_function(const clang::Expr* expr, bool& bound)
+    {
+        bound = false;
+        // conversions and variables to follow
+        const int max_depth = 8;
+        for (int depth = 0; expr && depth < max_depth; ++depth)
+        {
+            expr = expr->IgnoreImplicit()->IgnoreParens();
+            if (const auto* lambda = llvm::dyn_cast<clang::LambdaExpr>(expr))
+                return lambda->getCallOperator();
+
+            if (const auto* call = llvm::dyn_cast<clang::CallExpr>(expr))
+            {
+                const auto* callee = call->getDirectCallee();
+                bound = callee && callee->isInStdNamespace() && callee->getIdentifier() &&
+                        callee->getName() == "bind" && call->getNumArgs() > 0;
+                expr = bound ? call->getArg(0) : nullptr;
+            }
+            else if (const auto* construct = llvm::dyn_cast<clang::CXXConstructExpr>(expr))
+            {
+                expr = construct->getNumArgs() == 1 ? construct->getArg(0) : nullptr;
+            }
+            else if (const auto* unary = llvm::dyn_cast<clang::UnaryOperator>(expr))
+            {
+                expr = unary->getOpcode() == clang::UO_AddrOf ? unary->getSubExpr() : nullptr;
+            }
+            else if (const auto* ref = llvm::dyn_cast<clang::DeclRefExpr>(expr))
+            {
+                if (const auto* function = llvm::dyn_cast<clang::FunctionDecl>(ref->getDecl()))
+                    return function;
+                const auto* var = llvm::dyn_cast<clang::VarDecl>(ref->getDecl());
+                expr = var ? var->getInit() : nullptr;
+            }
+            else
+            {
+                return nullptr;
+            }
+        }
+        return nullptr;
     }
 
-    const std::set<PubSubEntry>& entries() const { return entries_; }
-    const std::set<std::string>& bases(const std::string& thread) { return bases_[thread]; }
+    struct Hazard
+    {
+        // of the blocking call
+        std::string site;
+        // "name (site) -> ..." for each call from the function down to the blocking call
+        std::string chain;
+    };
+
+    // The calls to blocking APIs in the body of function and, up to depth calls deeper, in the
+    // project functions it calls (the first chain found to each blocking call)
+    const std::vector<Hazard>& blocking_calls(const clang::FunctionDecl& function, int depth,
+                                              const clang::SourceManager& source_manager)
+    {
+        const clang::FunctionDecl* definition = nullptr;
+        if (!function.hasBody(definition))
+            definition = &function;
+
+        auto key = std::make_pair(definition, depth);
+        auto it = blocking_calls_.find(key);
+        if (it != blocking_calls_.end())
+            return it->second;
+        // empty while being found, which ends recursion
+        blocking_calls_[key];
+
+        std::vector<Hazard> hazards;
+        std::set<std::string> sites;
+        find_blocking_calls(definition->getBody(), depth, source_manager, hazards, sites);
+        return blocking_calls_[key] = std::move(hazards);
+    }
 
-  private:    
-    std::string as_string(const clang::Type& type)
+    void find_blocking_calls(const clang::Stmt* stmt, int depth,
+                             const clang::SourceManager& source_manager,
+                             std::vector<Hazard>& hazards, std::set<std::string>& sites)
     {
+        // lambdas defined here may well be run elsewhere (e.g. by another thread)
+        if (!stmt || llvm::isa<clang::LambdaExpr>(stmt))
+            return;
+
+        const clang::FunctionDecl* callee = nullptr;
+        if (const auto* call = llvm::dyn_cast<clang::CallExpr>(stmt))
+            callee = call->getDirectCallee();
+        else if (const auto* construct = llvm::dyn_cast<clang::CXXConstructExpr>(stmt))
+        {
+            // e.g. std::lock_guard(m, std::adopt_lock) doesn't lock
+            if (!has_lock_tag_argument(*construct))
+                callee = construct->getConstructor();
+        }
+
+        if (callee)
+        {
+            auto name = name_without_template_args(*callee);
+            auto site = call_site(*stmt, source_manager);
+            const clang::FunctionDecl* definition = nullptr;
+            if (is_blocking(name, *callee, source_manager))
+            {
+                if (sites.insert(site).second)
+                    hazards.push_back({site, name + " (" + site + ")"});
+            }
+            else if (depth > 0 && callee->hasBody(definition) &&
+                     is_project_code(*definition, source_manager))
+            {
+                for (const auto& hazard : blocking_calls(*definition, depth - 1, source_manager))
+                {
+                    if (sites.insert(hazard.site).second)
+                        hazards.push_back(
+                            {hazard.site, name + " (" + site + ") -> " + hazard.chain});
+                }
+            }
+        }
+
+        for (const auto* child : stmt->children())
+            find_blocking_calls(child, depth, source_manager, hazards, sites);
+    }
+
+    // name (of callee) is one of blocking_apis_ or a member of one. Unqualified APIs (e.g. "read")
+    // only match functions first declared in a system header, so that a project's own global
+    // functions with the same names as the C library's aren't reported.
+    bool is_blocking(const std::string& name, const clang::FunctionDecl& callee,
+                     const clang::SourceManager& source_manager) const
+    {
+        for (const auto& api : blocking_apis_)
+        {
+            if (name.compare(0, api.size(), api) != 0 ||
+                (name.size() != api.size() && name.compare(api.size(), 2, "::") != 0))
+                continue;
+            if (api.find("::") != std::string::npos ||
+                source_manager.isInSystemHeader(
+                    source_manager.getExpansionLoc(callee.getCanonicalDecl()->getLocation())))
+                return true;
+        }
+        return false;
+    }
+
+    // construct is passed std::adopt_lock, std::defer_lock or std::try_to_lock
+    static bool has_lock_tag_argument(const clang::CXXConstructExpr& construct)
+    {
+        for (const auto* arg : construct.arguments())
+        {
+            const auto* record = arg->getType()->getAsCXXRecordDecl();
+            if (!record)
+                continue;
+            auto name = name_without_template_args(*record);
+            if (name == "std::adopt_lock_t" || name == "std::defer_lock_t" ||
+                name == "std::try_to_lock_t")
+                return true;
+        }
+        return false;
+    }
+
+    // the qualified name of decl without template arguments or inline namespaces, e.g.
+    // "std::lock_guard::lock_guard"
+    static std::string name_without_template_args(const clang::NamedDecl& decl)
+    {
+        std::string name = decl.getNameAsString();
+        for (const auto* context = decl.getDeclContext(); context; context = context->getParent())
+        {
+            const auto* named = llvm::dyn_cast<clang::NamedDecl>(context);
+            if (named && !context->isInlineNamespace() && !named->getDeclName().isEmpty())
+                name = named->getNameAsString() + "::" + name;
+        }
+        return name;
+    }
+
+    // defined outside the system headers and goby, so worth following for blocking calls
+    static bool is_project_code(const clang::FunctionDecl& definition,
+                                const clang::SourceManager& source_manager)
+    {
+        auto loc = source_manager.getExpansionLoc(definition.getLocation());
+        return loc.isValid() && !source_manager.isInSystemHeader(loc) &&
+               !goby::clang::is_goby_middleware_header(source_manager.getFilename(loc).str());
+    }
+
+    // the statements from root down to target (exclusive), if target is within root
+    static bool find_path(const clang::Stmt* root, const clang::Stmt* target,
+                          std::vector<const clang::Stmt*>& path)
+    {
+        if (!root)
+            return false;
+        if (root == target)
+            return true;
+
+        path.push_back(root);
+        for (const auto* child : root->children())
+        {
+            if (find_path(child, target, path))
+                return true;
+        }
+        path.pop_back();
+        return false;
+    }
+
+    // the group of the subscribe() call that a lambda is passed to, given the statements
+    // enclosing the lambda (innermost first): only conversions may come between them
+    template <typename Iterator> std::string subscribe_group(Iterator begin, Iterator end)
+    {
+        for (auto it = begin; it != end; ++it)
+        {
+            if (const auto* call = llvm::dyn_cast<clang::CXXMemberCallExpr>(*it))
+            {
+                const auto* method = call->getMethodDecl();
+                if (!method || !method->getIdentifier() || method->getName() != "subscribe")
+                    return std::string();
+                const auto* args = method->getTemplateSpecializationArgs();
+                if (!args || args->size() == 0 ||
+                    args->get(0).getKind() != clang::TemplateArgument::Declaration)
+                    return std::string();
+                const auto* group = llvm::dyn_cast<clang::VarDecl>(args->get(0).getAsDecl());
+                const auto* group_string = group ? find_string_literal(group->getInit()) : nullptr;
+                return group_string ? group_string->getString().str() : std::string();
+            }
+
+            if (!llvm::isa<clang::Expr>(*it) || llvm::isa<clang::CallExpr>(*it))
+                return std::string();
+        }
+        return std::string();
+    }
+
+    static const clang::StringLiteral* find_string_literal(const clang::Stmt* stmt)
+    {
+        if (!stmt)
+            return nullptr;
+        if (const auto* literal = llvm::dyn_cast<clang::StringLiteral>(stmt))
+            return literal;
+        for (const auto* child : stmt->children())
+        {
+            if (const auto* literal = find_string_literal(child))
+                return literal;
+        }
+        return nullptr;
+    }
+
+    // The loop frequency (Hz) that the constructors of a thread pass to its goby base class (as
+    // the argument for a parameter named "*freq*"), if it is a constant; empty otherwise
+    std::string loop_frequency(const clang::CXXRecordDecl& record, int depth = 0)
+    {
+        // user classes between the thread and the goby base
+        const int max_depth = 8;
+        if (depth > max_depth)
+            return std::string();
+
+        for (const auto* declared_constructor : record.ctors())
+        {
+            const clang::FunctionDecl* definition = nullptr;
+            if (!declared_constructor->hasBody(definition))
+                continue;
+            const auto* constructor = llvm::dyn_cast<clang::CXXConstructorDecl>(definition);
+            if (!constructor)
+                continue;
+
+            for (const auto* init : constructor->inits())
+            {
+                if (!init->isBaseInitializer() || !init->getInit())
+                    continue;
+                const auto* base = init->getBaseClass()->getAsCXXRecordDecl();
+                const auto* construct =
+                    llvm::dyn_cast<clang::CXXConstructExpr>(init->getInit()->IgnoreImplicit());
+                if (!base || !construct)
+                    continue;
+
+                if (base->getQualifiedNameAsString().find("goby::") != 0)
+                {
+                    auto frequency = loop_frequency(*base, depth + 1);
+                    if (!frequency.empty())
+                        return frequency;
+                    continue;
+                }
+
+                const auto* base_constructor = construct->getConstructor();
+                for (unsigned i = 0, n = std::min(construct->getNumArgs(),
+                                                   base_constructor->getNumParams());
+                     i < n; ++i)
+                {
+                    auto name = base_constructor->getParamDecl(i)->getName();
+                    if (name.find("freq") != llvm::StringRef::npos)
+                        return constant_number(construct->getArg(i), record.getASTContext());
+                }
+            }
+        }
+        return std::string();
+    }
+
+    // The value of expr if it contains exactly one constant arithmetic subexpression, e.g. 10 in
+    // "10 * boost::units::si::hertz"; empty otherwise
+    static std::string constant_number(const clang::Expr* expr, const clang::ASTContext& context)
+    {
+        std::vector<double> constants;
+        std::function<void(const clang::Stmt*)> find_constants = [&](const clang::Stmt* stmt) {
+            const auto* e = llvm::dyn_cast_or_null<clang::Expr>(stmt);
+            if (e && !e->isValueDependent() && e->getType()->isArithmeticType())
+            {
+                clang::Expr::EvalResult result;
+                if (e->EvaluateAsRValue(result, context))
+                {
+                    if (result.Val.isInt())
+                        constants.push_back(result.Val.getInt().getSExtValue());
+                    else if (result.Val.isFloat())
+                    {
+                        auto value = result.Val.getFloat();
+                        bool loses_info;
+                        value.convert(llvm::APFloat::IEEEdouble(),
+                                      llvm::APFloat::rmNearestTiesToEven, &loses_info);
+                        constants.push_back(value.convertToDouble());
+                    }
+                    return;
+                }
+            }
+            if (stmt)
+            {
+                for (const auto* child : stmt->children()) find_constants(child);
+            }
+        };
+        find_constants(expr);
+
+        if (constants.size() != 1)
+            return std::string();
+        std::ostringstream number;
+        number << constants.front();
+        return number.str();
+    }
+
+    // The thread making the call: the first member call on a pointer to a class derived from
+    // goby::middleware::Thread in the transporter expression, e.g. "this" in
+    // "this->interprocess()" or in "this->goby().interprocess()"
+    const clang::CXXRecordDecl* find_thread(const clang::Stmt* stmt)
+    {
+        if (!stmt)
+            return nullptr;
+
+        if (const auto* member_call = llvm::dyn_cast<clang::CXXMemberCallExpr>(stmt))
+        {
+            const auto* object = member_call->getImplicitObjectArgument();
+            if (object)
+            {
+                auto object_type = object->IgnoreParenImpCasts()->getType();
+                if (object_type->isPointerType())
+                {
+                    const auto* record = object_type->getPointeeType()->getAsCXXRecordDecl();
+                    if (record && thread_cache_.is_derived(record))
+                        return record;
+                }
+            }
+        }
+
+        for (const auto* child : stmt->children())
+        {
+            if (const auto* thread = find_thread(child))
+                return thread;
+        }
+        return nullptr;
+    }
+
+    struct ThreadInfo
+    {
+        std::string name;
+        std::set<std::string> bases;
+    };
+
+    const ThreadInfo& thread_info(const clang::CXXRecordDecl& thread_decl)
+    {
+        auto it = thread_info_.find(&thread_decl);
+        if (it != thread_info_.end())
+            return it->second;
+
+        ThreadInfo info;
+        info.name = as_string(thread_decl);
+        for (auto base_it = thread_decl.bases_begin(), end = thread_decl.bases_end();
+             base_it != end; ++base_it)
+        {
+            if (const auto* base_decl = base_it->getType()->getAsCXXRecordDecl())
+                info.bases.insert(as_string(*base_decl));
+        }
+        return thread_info_.emplace(&thread_decl, std::move(info)).first->second;
+    }
+
+    // pretty printing template types is expensive, so each canonical type is only printed once
+    const std::string& as_string(const clang::Type& type)
+    {
+        const clang::QualType canonical = type.getCanonicalTypeInternal();
+        auto it = type_strings_.find(canonical.getAsOpaquePtr());
+        if (it != type_strings_.end())
+            return it->second;
+
         // todo: see if there's a cleaner way to get this with the template parameters
-        std::string str(type.getCanonicalTypeInternal().getAsString());
+        std::string str(canonical.getAsString());
 
         // remove class, struct
         std::string class_str = "class ";
@@ -136,55 +841,648 @@ class PubSubAggregator : public ::clang::ast_matchers::MatchFinder::MatchCallbac
         if (str.find(struct_str) == 0)
             str = str.substr(struct_str.size());
 
-        return str;
+        return type_strings_.emplace(canonical.getAsOpaquePtr(), std::move(str)).first->second;
     }
 
-    std::string as_string(const clang::CXXRecordDecl& cxx_decl)
+    const std::string& as_string(const clang::CXXRecordDecl& cxx_decl)
     {
         return as_string(*(cxx_decl.getTypeForDecl()));
     }
 
   private:
-    std::set<PubSubEntry> entries_;
+    std::shared_ptr<DerivationCache> transporter_cache_;
+    DerivationCache thread_cache_;
+    // keyed by canonical type / declaration, so only valid within a single translation unit
+    std::unordered_map<const void*, std::string> type_strings_;
+    std::unordered_map<const clang::CXXRecordDecl*, ThreadInfo> thread_info_;
+
+    const clang::FunctionDecl* function_{nullptr};
+
+    std::vector<std::string> blocking_apis_;
+    int blocking_depth_;
+    // keyed by definition and depth, so only valid within a single translation unit
+    std::map<std::pair<const clang::FunctionDecl*, int>, std::vector<Hazard>> blocking_calls_;
+
+    std::set<PubSubEntry> publishes_;
+    std::set<PubSubEntry> subscribes_;
     // map thread to bases
     std::map<std::string, std::set<std::string>> bases_;
+    std::map<std::string, goby::clang::TypeLayout> types_;
+};
+
+// include system headers as well, since goby and its dependencies are usually included that way
+class AllDependencyCollector : public ::clang::DependencyCollector
+{
+  public:
+    bool needSystemDependencies() override { return true; }
 };
 
-int goby::clang::generate(::clang::tooling::ClangTool& Tool, std::string output_directory,
-                          std::string output_file, std::string target_name)
+// records every file the preprocessor reads for a translation unit
+class DependencyRecorder : public ::clang::tooling::SourceFileCallbacks
 {
-    PubSubAggregator publish_aggregator, subscribe_aggregator;
+  public:
+    bool handleBeginSource(::clang::CompilerInstance& CI) override
+    {
+        ci_ = &CI;
+        collector_ = std::make_shared<AllDependencyCollector>();
+        collector_->attachToPreprocessor(CI.getPreprocessor());
+        // also records the inputs of a PCH loaded with -include-pch (not yet loaded at this point)
+        CI.addDependencyCollector(collector_);
+        return true;
+    }
+
+    void handleEndSource() override
+    {
+        for (const auto& dependency : collector_->getDependencies())
+        {
+            llvm::SmallString<256> path(dependency);
+            ci_->getFileManager().makeAbsolutePath(path);
+            llvm::sys::path::remove_dots(path, true);
+            dependencies_.push_back(path.str().str());
+        }
+        collector_.reset();
+    }
+
+    // dependencies of all the compile commands run since the last call
+    std::vector<std::string> take()
+    {
+        std::vector<std::string> dependencies;
+        dependencies.swap(dependencies_);
+        return dependencies;
+    }
+
+  private:
+    ::clang::CompilerInstance* ci_{nullptr};
+    std::shared_ptr<AllDependencyCollector> collector_;
+    std::vector<std::string> dependencies_;
+};
+
+::clang::ast_matchers::MatchFinder::MatchFinderOptions
+finder_options(llvm::StringMap<llvm::TimeRecord>& profile_records, bool profile)
+{
+    ::clang::ast_matchers::MatchFinder::MatchFinderOptions options;
+    if (profile)
+        options.CheckProfiling.emplace(profile_records);
+    return options;
+}
+
+// Results of matching function bodies defined in headers, keyed by USR and file, shared by all
+// the workers so that each body is matched by only one translation unit
+class MatchedBodies
+{
+  public:
+    // the results of matching the body if another translation unit has already done so
+    bool find(const std::string& key, InterfaceFragment& fragment)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = bodies_.find(key);
+        if (it == bodies_.end())
+            return false;
+        fragment = it->second;
+        ++reused_;
+        return true;
+    }
+
+    void insert(std::vector<std::pair<std::string, InterfaceFragment>>& bodies)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& body_p : bodies) bodies_.insert(std::move(body_p));
+        bodies.clear();
+    }
+
+    std::size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bodies_.size();
+    }
+
+    std::size_t reused()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return reused_;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::map<std::string, InterfaceFragment> bodies_;
+    std::size_t reused_{0};
+};
+
+// independent matcher state for each thread parsing translation units
+struct GenerateWorker
+{
+    GenerateWorker(MatchedBodies& matched_bodies, const std::vector<std::string>& blocking_apis,
+                   const goby::clang::GenerateOptions& options)
+        : bodies(matched_bodies),
+          aggregator(blocking_apis, options.blocking_depth),
+          finder(finder_options(profile_records, options.match_profile))
+    {
+        finder.addMatcher(
+            ::clang::ast_matchers::findAll(pubsub_matcher(aggregator.transporter_cache())),
+            &aggregator);
+    }
+
+    void start_translation_unit()
+    {
+        aggregator.start_translation_unit();
+        new_bodies.clear();
+    }
+
+    // match the body (and constructor initializers) of a function, reusing the results from
+    // another translation unit for those defined in headers
+    void match_function(const clang::FunctionDecl& function, clang::ASTContext& context)
+    {
+        const auto& source_manager = context.getSourceManager();
+        auto loc = source_manager.getExpansionLoc(function.getLocation());
+        // pubsub_matcher() ignores every call in these
+        if (is_outside_project_code(loc, source_manager))
+            return;
+
+        std::string file = source_manager.getFilename(loc).str();
+        llvm::SmallString<128> usr;
+        if (source_manager.isInMainFile(loc) ||
+            clang::index::generateUSRForDecl(&function, usr))
+        {
+            match_function_body(function, context);
+            return;
+        }
+
+        std::string key = usr.str().str() + '\0' + file;
+        InterfaceFragment body_fragment;
+        if (bodies.find(key, body_fragment))
+        {
+            fragment.merge(body_fragment);
+            return;
+        }
+
+        aggregator.take(body_fragment);
+        fragment.merge(body_fragment);
+        match_function_body(function, context);
+        aggregator.take(body_fragment);
+        fragment.merge(body_fragment);
+        new_bodies.emplace_back(key, std::move(body_fragment));
+    }
+
+    void match(const clang::Stmt& stmt, clang::ASTContext& context)
+    {
+        finder.match(stmt, context);
+        accumulate_profile();
+    }
+
+    // make the bodies matched by the last translation unit available to the other workers
+    // (only called if it parsed without errors)
+    void share_bodies() { bodies.insert(new_bodies); }
+
+    // results of the translation unit(s) parsed since the last call
+    InterfaceFragment take_fragment()
+    {
+        InterfaceFragment remaining;
+        aggregator.take(remaining);
+        fragment.merge(remaining);
+
+        InterfaceFragment result;
+        std::swap(result, fragment);
+        return result;
+    }
+
+    // MatchFinder overwrites the profile for each match, so keep a running total
+    void accumulate_profile()
+    {
+        for (const auto& record : profile_records)
+            profile_totals[record.getKey().str()] += record.getValue();
+        profile_records.clear();
+    }
+
+    // called by newFrontendActionFactory()
+    std::unique_ptr<clang::ASTConsumer> newASTConsumer();
+
+    MatchedBodies& bodies;
+    std::vector<std::pair<std::string, InterfaceFragment>> new_bodies;
+    InterfaceFragment fragment;
+    PubSubAggregator aggregator;
+    llvm::StringMap<llvm::TimeRecord> profile_records;
+    std::map<std::string, llvm::TimeRecord> profile_totals;
     ::clang::ast_matchers::MatchFinder finder;
+    DependencyRecorder dependencies;
+    int retval{0};
+
+  private:
+    void match_function_body(const clang::FunctionDecl& function, clang::ASTContext& context)
+    {
+        aggregator.set_function(&function);
+        if (const auto* constructor = llvm::dyn_cast<clang::CXXConstructorDecl>(&function))
+        {
+            for (const auto* init : constructor->inits())
+            {
+                if (init->isWritten() && init->getInit())
+                    match(*init->getInit(), context);
+            }
+        }
+        if (const auto* body = function.getBody())
+            match(*body, context);
+        aggregator.set_function(nullptr);
+    }
+};
 
-    finder.addMatcher(pubsub_matcher("publish"), &publish_aggregator);
-    finder.addMatcher(pubsub_matcher("subscribe"), &subscribe_aggregator);
+// Hands each function body (and any statement outside a function) to the worker separately,
+// rather than matching the whole translation unit at once
+class FunctionBodyVisitor : public clang::RecursiveASTVisitor<FunctionBodyVisitor>
+{
+  public:
+    FunctionBodyVisitor(GenerateWorker& worker, clang::ASTContext& context)
+        : worker_(worker), context_(context)
+    {
+    }
 
-    if (output_file.empty())
-        output_file = target_name + "_interface.yml";
+    // as MatchFinder::matchAST()
+    bool shouldVisitTemplateInstantiations() const { return true; }
+    bool shouldVisitImplicitCode() const { return true; }
 
-    std::string file_name(output_directory + "/" + output_file);
-    std::ofstream ofs(file_name.c_str());
-    if (!ofs.is_open())
+    bool TraverseDecl(clang::Decl* decl)
+    {
+        const auto* function = llvm::dyn_cast_or_null<clang::FunctionDecl>(decl);
+        if (function && function->doesThisDeclarationHaveABody())
+        {
+            worker_.match_function(*function, context_);
+            return true;
+        }
+        return RecursiveASTVisitor::TraverseDecl(decl);
+    }
+
+    // e.g. variable initializers; findAll() covers everything within (including lambdas)
+    bool TraverseStmt(clang::Stmt* stmt)
+    {
+        if (stmt)
+            worker_.match(*stmt, context_);
+        return true;
+    }
+
+  private:
+    GenerateWorker& worker_;
+    clang::ASTContext& context_;
+};
+
+class FunctionBodyConsumer : public clang::ASTConsumer
+{
+  public:
+    FunctionBodyConsumer(GenerateWorker& worker) : worker_(worker) {}
+
+    void HandleTranslationUnit(clang::ASTContext& context) override
+    {
+        worker_.start_translation_unit();
+        FunctionBodyVisitor(worker_, context).TraverseDecl(context.getTranslationUnitDecl());
+    }
+
+  private:
+    GenerateWorker& worker_;
+};
+
+std::unique_ptr<clang::ASTConsumer> GenerateWorker::newASTConsumer()
+{
+    return std::unique_ptr<clang::ASTConsumer>(new FunctionBodyConsumer(*this));
+}
+
+// textual form of everything in the compilation database that affects parsing source
+std::string compile_commands_text(const ::clang::tooling::CompilationDatabase& compilations,
+                                  const std::string& source)
+{
+    std::string text;
+    for (const auto& command : compilations.getCompileCommands(source))
+    {
+        text += command.Directory + '\0' + command.Filename + '\0';
+        for (const auto& arg : command.CommandLine) text += arg + '\0';
+        text += '\n';
+    }
+    return text;
+}
+
+// combine ClangTool::run() return values: 1 (failed) takes precedence over 2 (skipped files)
+int combine_retval(int a, int b)
+{
+    if (a == 1 || b == 1)
+        return 1;
+    return std::max(a, b);
+}
+
+std::unique_ptr<std::ofstream> open_output(const std::string& file_name)
+{
+    std::unique_ptr<std::ofstream> ofs(new std::ofstream(file_name.c_str()));
+    if (!ofs->is_open())
     {
         std::cerr << "Failed to open " << file_name << " for writing" << std::endl;
         exit(EXIT_FAILURE);
     }
+    return ofs;
+}
 
-    auto retval = Tool.run(::clang::tooling::newFrontendActionFactory(&finder).get());
+// sleeps, file and socket I/O, mutex locks and waits, and synchronous boost::asio calls. Only the
+// members that block are listed (not whole classes), so that e.g. std::unique_lock::unlock or
+// std::basic_ifstream::is_open aren't reported
+std::vector<std::string> default_blocking_apis()
+{
+    return {"std::this_thread::sleep_for",
+            "std::this_thread::sleep_until",
+            "sleep",
+            "usleep",
+            "nanosleep",
+            "system",
+            "fopen",
+            "fread",
+            "fwrite",
+            "fgets",
+            "fflush",
+            "std::basic_ifstream::basic_ifstream",
+            "std::basic_ifstream::open",
+            "std::basic_ofstream::basic_ofstream",
+            "std::basic_ofstream::open",
+            "std::basic_ofstream::close",
+            "std::basic_fstream::basic_fstream",
+            "std::basic_fstream::open",
+            "std::basic_fstream::close",
+            "open",
+            "read",
+            "write",
+            "recv",
+            "recvfrom",
+            "send",
+            "sendto",
+            "accept",
+            "connect",
+            "select",
+            "poll",
+            "std::mutex::lock",
+            "std::recursive_mutex::lock",
+            "std::timed_mutex::lock",
+            "std::shared_mutex::lock",
+            "std::lock_guard::lock_guard",
+            "std::unique_lock::unique_lock",
+            "std::unique_lock::lock",
+            "std::scoped_lock::scoped_lock",
+            "std::condition_variable::wait",
+            "std::condition_variable::wait_for",
+            "std::condition_variable::wait_until",
+            "std::future::get",
+            "std::future::wait",
+            "std::thread::join",
+            "boost::asio::read",
+            "boost::asio::read_at",
+            "boost::asio::read_until",
+            "boost::asio::write",
+            "boost::asio::write_at",
+            "boost::asio::connect",
+            "boost::asio::basic_socket::connect",
+            "boost::asio::basic_stream_socket::read_some",
+            "boost::asio::basic_stream_socket::write_some",
+            "boost::asio::basic_stream_socket::receive",
+            "boost::asio::basic_stream_socket::send",
+            "boost::asio::basic_datagram_socket::receive_from",
+            "boost::asio::basic_datagram_socket::send_to",
+            "boost::asio::basic_serial_port::read_some",
+            "boost::asio::basic_serial_port::write_some",
+            "boost::asio::io_context::run"};
+}
 
-    std::set<Layer> layers_in_use;
-    std::set<std::string> threads_in_use;
-    for (const auto& e : publish_aggregator.entries())
+// parse each of the sources, returning the results in the same order
+int extract_fragments(const ::clang::tooling::CompilationDatabase& compilations,
+                      const std::vector<std::string>& sources,
+                      const goby::clang::GenerateOptions& options,
+                      std::vector<InterfaceFragment>& fragments)
+{
+    unsigned jobs = options.jobs;
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min<std::size_t>(jobs, std::max<std::size_t>(1, sources.size()));
+
+    auto blocking_apis = options.blocking_apis;
+    if (blocking_apis.empty())
+        blocking_apis = default_blocking_apis();
+
+    std::unique_ptr<goby::clang::TranslationUnitCache> cache;
+    if (!options.cache_directory.empty())
+    {
+        // the blocking call settings change the results
+        std::string signature = "blocking_depth=" + std::to_string(options.blocking_depth);
+        for (const auto& api : blocking_apis) signature += '\0' + api;
+        cache.reset(new goby::clang::TranslationUnitCache(options.cache_directory, signature));
+    }
+
+    std::unique_ptr<goby::clang::TransporterPrefilter> prefilter;
+    if (options.prefilter)
+        prefilter.reset(new goby::clang::TransporterPrefilter);
+
+    std::unique_ptr<goby::clang::PrecompiledPreambles> preambles;
+    if (!options.pch_directory.empty())
+    {
+        auto headers = options.pch_headers;
+        if (headers.empty())
+            headers = {"goby/middleware/marshalling/interface.h",
+                       "goby/middleware/transport/interthread.h",
+                       "goby/middleware/transport/interprocess.h",
+                       "goby/middleware/transport/intervehicle.h"};
+        preambles.reset(new goby::clang::PrecompiledPreambles(options.pch_directory, headers));
+    }
+
+    MatchedBodies matched_bodies;
+    std::vector<std::unique_ptr<GenerateWorker>> workers;
+    for (unsigned i = 0; i < jobs; ++i)
+        workers.emplace_back(new GenerateWorker(matched_bodies, blocking_apis, options));
+
+    fragments.assign(sources.size(), InterfaceFragment());
+    std::atomic<std::size_t> cache_hits{0};
+    std::atomic<std::size_t> prefiltered{0};
+
+    // each worker pulls the next unparsed translation unit until none remain
+    std::atomic<std::size_t> next_source{0};
+    auto run_worker = [&](GenerateWorker& worker) {
+        auto factory = ::clang::tooling::newFrontendActionFactory(
+            &worker, cache ? &worker.dependencies : nullptr);
+        for (auto i = next_source++; i < sources.size(); i = next_source++)
+        {
+            if (prefilter)
+            {
+                // leave files without a compile command for ClangTool to report
+                auto commands = compilations.getCompileCommands(sources[i]);
+                bool may_match = commands.empty();
+                for (const auto& command : commands)
+                    may_match = may_match || prefilter->may_match(command.Directory,
+                                                                  command.Filename,
+                                                                  command.CommandLine);
+                if (!may_match)
+                {
+                    ++prefiltered;
+                    continue;
+                }
+            }
+
+            std::string key;
+            if (cache)
+            {
+                key = cache->key(compile_commands_text(compilations, sources[i]));
+                if (cache->load(key, fragments[i]))
+                {
+                    ++cache_hits;
+                    continue;
+                }
+            }
+
+            std::string pch;
+            if (preambles)
+            {
+                // all the compile commands for this file must be able to share the preamble
+                auto commands = compilations.getCompileCommands(sources[i]);
+                if (commands.size() == 1)
+                    pch = preambles->get(commands.front());
+            }
+
+            auto parse = [&](const std::string& preamble_pch) {
+                // separate file system per tool so that each has its own working directory
+                ::clang::tooling::ClangTool tool(
+                    compilations, {sources[i]}, std::make_shared<::clang::PCHContainerOperations>(),
+                    llvm::vfs::createPhysicalFileSystem());
+                if (!preamble_pch.empty())
+                    tool.appendArgumentsAdjuster(::clang::tooling::getInsertArgumentAdjuster(
+                        {"-include-pch", preamble_pch},
+                        ::clang::tooling::ArgumentInsertPosition::BEGIN));
+                return tool.run(factory.get());
+            };
+
+            int tu_retval = parse(pch);
+            if (tu_retval == 1 && !pch.empty())
+            {
+                // discard any partial results and try again without the preamble
+                worker.take_fragment();
+                worker.dependencies.take();
+                tu_retval = parse("");
+                if (tu_retval == 0)
+                    preambles->invalidate(pch);
+            }
+            worker.retval = combine_retval(worker.retval, tu_retval);
+            if (tu_retval == 0)
+                worker.share_bodies();
+            fragments[i] = worker.take_fragment();
+
+            auto dependencies = worker.dependencies.take();
+            if (cache && tu_retval == 0)
+                cache->store(key, dependencies, fragments[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < jobs; ++i) threads.emplace_back(run_worker, std::ref(*workers[i]));
+    run_worker(*workers[0]);
+    for (auto& thread : threads) thread.join();
+
+    int retval = 0;
+    for (const auto& worker : workers) retval = combine_retval(retval, worker->retval);
+
+    if (options.stats)
+    {
+        if (prefilter)
+            std::cerr << "Skipped " << prefiltered << " of " << sources.size()
+                      << " translation units without publish or subscribe calls" << std::endl;
+        if (cache)
+            std::cerr << "Reused cached results for " << cache_hits << " of " << sources.size()
+                      << " translation units" << std::endl;
+        if (preambles)
+            preambles->report(std::cerr);
+        std::cerr << "Reused the matches in " << matched_bodies.size()
+                  << " function bodies defined in headers " << matched_bodies.reused() << " times"
+                  << std::endl;
+    }
+    if (options.match_profile)
+    {
+        std::map<std::string, llvm::TimeRecord> profile;
+        for (const auto& worker : workers)
+        {
+            for (const auto& record_p : worker->profile_totals)
+                profile[record_p.first] += record_p.second;
+        }
+
+        std::cerr << "Matcher profile (seconds, summed over all workers):" << std::endl;
+        for (const auto& record_p : profile)
+            std::cerr << "\t" << record_p.first << ": wall " << record_p.second.getWallTime()
+                      << ", user " << record_p.second.getUserTime() << ", system "
+                      << record_p.second.getSystemTime() << std::endl;
+    }
+
+    return retval;
+}
+
+// Ranges of a set of entries by layer and by (layer, thread); PubSubEntry sorts by layer then
+// thread so each is contiguous
+class EntryIndex
+{
+  public:
+    using Iterator = std::set<PubSubEntry>::const_iterator;
+    using Range = std::pair<Iterator, Iterator>;
+
+    EntryIndex(const std::set<PubSubEntry>& entries) : end_(entries.end())
+    {
+        for (auto it = entries.begin(); it != end_; ++it)
+        {
+            layer_begin_.emplace(it->layer, it);
+            auto range_it = thread_ranges_.emplace(std::make_pair(it->layer, it->thread),
+                                                   std::make_pair(it, it));
+            ++range_it.first->second.second;
+        }
+    }
+
+    // all the entries in layer and any outer layers
+    Range from_layer(Layer layer) const
+    {
+        auto it = layer_begin_.lower_bound(layer);
+        return {it == layer_begin_.end() ? end_ : it->second, end_};
+    }
+
+    Range in_layer(Layer layer) const
+    {
+        auto it = layer_begin_.find(layer);
+        if (it == layer_begin_.end())
+            return {end_, end_};
+        auto next_it = std::next(it);
+        return {it->second, next_it == layer_begin_.end() ? end_ : next_it->second};
+    }
+
+    Range in_layer(Layer layer, goby::clang::Symbol thread) const
+    {
+        auto it = thread_ranges_.find(std::make_pair(layer, thread));
+        return it == thread_ranges_.end() ? Range(end_, end_) : it->second;
+    }
+
+    // layers (in order) with any entries
+    std::vector<Layer> layers() const
     {
-        layers_in_use.insert(e.layer);
-        threads_in_use.insert(e.thread);
+        std::vector<Layer> layers;
+        for (const auto& layer_p : layer_begin_) layers.push_back(layer_p.first);
+        return layers;
     }
-    for (const auto& e : subscribe_aggregator.entries())
+
+    void insert_layers_and_threads(std::set<Layer>& layers, std::set<std::string>& threads) const
     {
-        layers_in_use.insert(e.layer);
-        threads_in_use.insert(e.thread);
+        for (const auto& range_p : thread_ranges_)
+        {
+            layers.insert(range_p.first.first);
+            threads.insert(range_p.first.second.str());
+        }
     }
 
+  private:
+    Iterator end_;
+    std::map<Layer, Iterator> layer_begin_;
+    std::map<std::pair<Layer, goby::clang::Symbol>, Range> thread_ranges_;
+};
+
+// write the interface YAML of the application target_name
+void write_interface(const InterfaceFragment& interface, const std::string& target_name,
+                     std::ostream& os)
+{
+    const EntryIndex publishes(interface.publishes), subscribes(interface.subscribes);
+
+    std::set<Layer> layers_in_use;
+    std::set<std::string> threads_in_use;
+    publishes.insert_layers_and_threads(layers_in_use, threads_in_use);
+    subscribes.insert_layers_and_threads(layers_in_use, threads_in_use);
+
     // intervehicle requires interprocess at this point
     if (layers_in_use.count(Layer::INTERVEHICLE))
         layers_in_use.insert(Layer::INTERPROCESS);
@@ -199,30 +1497,41 @@ int goby::clang::generate(::clang::tooling::ClangTool& Tool, std::string output_
              ++layer_it)
         {
             Layer layer = *layer_it;
-            root_map.add_key(layer_to_str.at(layer));
+            root_map.add_key(goby::clang::to_string(layer));
             goby::yaml::YMap layer_map(yaml_out);
 
             auto emit_pub_sub = [&](goby::yaml::YMap& map, const std::string& thread) {
                 {
                     map.add_key("publishes");
                     goby::yaml::YSeq publish_seq(yaml_out);
-                    for (const auto& e : publish_aggregator.entries())
-                    {
+                    auto write_publishes = [&](EntryIndex::Range range) {
                         // show inner publications
-                        if (e.layer >= layer && (layer != Layer::INTERTHREAD || e.thread == thread))
-                            e.write_yaml_map(yaml_out, layer != Layer::INTERTHREAD,
-                                             e.layer > layer);
+                        for (auto it = range.first; it != range.second; ++it)
+                            it->write_yaml_map(yaml_out, layer != Layer::INTERTHREAD,
+                                               it->layer > layer);
+                    };
+
+                    if (layer == Layer::INTERTHREAD)
+                    {
+                        for (auto publish_layer : publishes.layers())
+                        {
+                            if (publish_layer >= layer)
+                                write_publishes(publishes.in_layer(publish_layer, thread));
+                        }
+                    }
+                    else
+                    {
+                        write_publishes(publishes.from_layer(layer));
                     }
                 }
 
                 {
                     map.add_key("subscribes");
                     goby::yaml::YSeq subscribe_seq(yaml_out);
-                    for (const auto& e : subscribe_aggregator.entries())
-                    {
-                        if (e.layer == layer && (layer != Layer::INTERTHREAD || e.thread == thread))
-                            e.write_yaml_map(yaml_out, layer != Layer::INTERTHREAD);
-                    }
+                    auto range = (layer == Layer::INTERTHREAD) ? subscribes.in_layer(layer, thread)
+                                                               : subscribes.in_layer(layer);
+                    for (auto it = range.first; it != range.second; ++it)
+                        it->write_yaml_map(yaml_out, layer != Layer::INTERTHREAD);
                 }
             };
 
@@ -236,15 +1545,12 @@ int goby::clang::generate(::clang::tooling::ClangTool& Tool, std::string output_
                     {
                         thread_map.add("name", thread);
 
-                        const auto& pub_bases = publish_aggregator.bases(thread);
-                        const auto& sub_bases = subscribe_aggregator.bases(thread);
-                        auto bases(pub_bases);
-                        bases.insert(sub_bases.begin(), sub_bases.end());
-                        if (!bases.empty())
+                        auto bases_it = interface.bases.find(thread);
+                        if (bases_it != interface.bases.end() && !bases_it->second.empty())
                         {
                             thread_map.add_key("bases");
                             goby::yaml::YSeq bases_seq(yaml_out);
-                            for (const auto& base : bases) bases_seq.add(base);
+                            for (const auto& base : bases_it->second) bases_seq.add(base);
                         }
 
                         emit_pub_sub(thread_map, thread);
@@ -256,9 +1562,194 @@ int goby::clang::generate(::clang::tooling::ClangTool& Tool, std::string output_
                 emit_pub_sub(layer_map, "");
             }
         }
+
+        if (!interface.types.empty())
+        {
+            root_map.add_key("types");
+            interface.write_types(yaml_out);
+        }
     }
 
-    ofs << yaml_out.c_str();
+    os << yaml_out.c_str();
+}
+
+int goby::clang::generate(const ::clang::tooling::CompilationDatabase& compilations,
+                          const std::vector<std::string>& sources, std::string output_directory,
+                          std::string output_file, std::string target_name,
+                          const GenerateOptions& options)
+{
+    if (output_file.empty())
+        output_file = target_name + "_interface.yml";
+    auto ofs = open_output(output_directory + "/" + output_file);
+
+    std::vector<InterfaceFragment> fragments;
+    int retval = extract_fragments(compilations, sources, options, fragments);
+
+    // merge in source order; the entries are sets so the result doesn't depend on scheduling
+    InterfaceFragment interface;
+    for (const auto& fragment : fragments) interface.merge(fragment);
+
+    write_interface(interface, target_name, *ofs);
+    return retval;
+}
+
+int goby::clang::generate_fragments(const ::clang::tooling::CompilationDatabase& compilations,
+                                    const std::vector<std::string>& sources,
+                                    std::string output_directory, std::string output_file,
+                                    const GenerateOptions& options)
+{
+    if (!output_file.empty() && sources.size() != 1)
+    {
+        std::cerr << "Can only specify -o with -gen-fragment for a single source file"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::unique_ptr<std::ofstream>> outputs;
+    for (const auto& source : sources)
+    {
+        std::string file_name = output_file;
+        if (file_name.empty())
+        {
+            // mirror the source path (relative to the current directory, or from the root for
+            // sources outside it) so that build rules can predict the name and sources with the
+            // same file name in different directories (e.g. src/a/util.cpp and src/b/util.cpp)
+            // are kept apart
+            llvm::SmallString<256> path(source), current;
+            llvm::sys::fs::make_absolute(path);
+            llvm::sys::path::remove_dots(path, true);
+            llvm::sys::fs::current_path(current);
+
+            std::string relative = path.str().str();
+            std::string current_prefix = current.str().str() + "/";
+            if (relative.compare(0, current_prefix.size(), current_prefix) == 0)
+                relative.erase(0, current_prefix.size());
+            else
+                relative = llvm::sys::path::relative_path(relative).str();
+            file_name = relative + ".interface_fragment.yml";
+
+            // open_output() reports the failure
+            llvm::sys::fs::create_directories(
+                llvm::sys::path::parent_path(output_directory + "/" + file_name));
+        }
+        outputs.push_back(open_output(output_directory + "/" + file_name));
+    }
+
+    std::vector<InterfaceFragment> fragments;
+    int retval = extract_fragments(compilations, sources, options, fragments);
+
+    for (std::size_t i = 0, n = sources.size(); i < n; ++i)
+    {
+        YAML::Emitter yaml_out;
+        fragments[i].write_yaml(yaml_out);
+        *outputs[i] << yaml_out.c_str();
+    }
+
+    return retval;
+}
+
+int goby::clang::merge(const std::vector<std::string>& fragment_files,
+                       std::string output_directory, std::string output_file,
+                       std::string target_name)
+{
+    if (output_file.empty())
+        output_file = target_name + "_interface.yml";
+    auto ofs = open_output(output_directory + "/" + output_file);
+
+    InterfaceFragment interface;
+    for (const auto& fragment_file : fragment_files)
+    {
+        try
+        {
+            interface.merge(InterfaceFragment(YAML::LoadFile(fragment_file)));
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Failed to parse interface fragment " << fragment_file << ": "
+                      << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    write_interface(interface, target_name, *ofs);
+    return 0;
+}
+
+int goby::clang::generate_batch(const ::clang::tooling::CompilationDatabase& compilations,
+                                const std::vector<std::string>& mapping_files,
+                                std::string output_directory, const GenerateOptions& options)
+{
+    // all the distinct sources (each parsed once), and the indices into them for each target
+    std::vector<std::string> sources;
+    std::map<std::string, std::size_t> source_index;
+    std::map<std::string, std::vector<std::size_t>> targets;
+
+    for (const auto& mapping_file : mapping_files)
+    {
+        YAML::Node mapping;
+        try
+        {
+            mapping = YAML::LoadFile(mapping_file);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Failed to parse target mapping file " << mapping_file << ": "
+                      << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        YAML::Node targets_node = mapping["targets"];
+        if (!targets_node || !targets_node.IsSequence())
+        {
+            std::cerr << "Must specify targets: as a sequence in target mapping file "
+                      << mapping_file << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        // relative source paths are relative to the mapping file
+        llvm::SmallString<256> mapping_directory(mapping_file);
+        llvm::sys::fs::make_absolute(mapping_directory);
+        llvm::sys::path::remove_filename(mapping_directory);
+
+        for (auto target_node : targets_node)
+        {
+            if (!target_node["name"] || !target_node["sources"] ||
+                !target_node["sources"].IsSequence())
+            {
+                std::cerr << "Must specify name: and sources: (as a sequence) for each target in "
+                          << mapping_file << std::endl;
+                exit(EXIT_FAILURE);
+            }
+
+            auto& target_sources = targets[target_node["name"].as<std::string>()];
+            for (auto source_node : target_node["sources"])
+            {
+                llvm::SmallString<256> source(source_node.as<std::string>());
+                llvm::sys::fs::make_absolute(mapping_directory, source);
+                llvm::sys::path::remove_dots(source, true);
+
+                auto it = source_index.insert(std::make_pair(source.str().str(), sources.size()));
+                if (it.second)
+                    sources.push_back(it.first->first);
+                target_sources.push_back(it.first->second);
+            }
+        }
+    }
+
+    std::map<std::string, std::unique_ptr<std::ofstream>> outputs;
+    for (const auto& target_p : targets)
+        outputs[target_p.first] =
+            open_output(output_directory + "/" + target_p.first + "_interface.yml");
+
+    std::vector<InterfaceFragment> fragments;
+    int retval = extract_fragments(compilations, sources, options, fragments);
+
+    for (const auto& target_p : targets)
+    {
+        InterfaceFragment interface;
+        for (auto index : target_p.second) interface.merge(fragments[index]);
+        write_interface(interface, target_p.first, *outputs[target_p.first]);
+    }
 
     return retval;
 }
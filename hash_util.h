@@ -0,0 +1,56 @@
+#ifndef HASH_UTIL_20191215H
+#define HASH_UTIL_20191215H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace goby
+{
+namespace clang
+{
+inline std::string md5_hex(llvm::StringRef data)
+{
+    llvm::MD5 hash;
+    hash.update(data);
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    return result.digest().str().str();
+}
+
+// Thread-safe memo of file content hashes, since most headers are read by many translation units
+class FileHashes
+{
+  public:
+    // md5 of the file contents, or empty if it cannot be read
+    std::string get(const std::string& path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = hashes_.find(path);
+            if (it != hashes_.end())
+                return it->second;
+        }
+
+        std::string hash;
+        auto buffer = llvm::MemoryBuffer::getFile(path);
+        if (buffer)
+            hash = md5_hex((*buffer)->getBuffer());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        hashes_[path] = hash;
+        return hash;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::map<std::string, std::string> hashes_;
+};
+} // namespace clang
+} // namespace goby
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef INTERFACE_FRAGMENT_20191215H
+#define INTERFACE_FRAGMENT_20191215H
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "pubsub_entry.h"
+#include "type_layout.h"
+#include "yaml_raii.h"
+
+namespace goby
+{
+namespace clang
+{
+// Partial interface extracted from one translation unit; fragments are merged to form the
+// complete interface of an application
+struct InterfaceFragment
+{
+    InterfaceFragment() = default;
+
+    // read from a node written by write_yaml()
+    InterfaceFragment(const YAML::Node& yaml)
+    {
+        auto read_entries = [](const YAML::Node& node, std::set<PubSubEntry>& entries) {
+            for (auto layer_it = node.begin(), end = node.end(); layer_it != end; ++layer_it)
+            {
+                Layer layer = layer_from_string(layer_it->first.as<std::string>());
+                for (auto e : layer_it->second) insert_merged(entries, PubSubEntry(layer, e));
+            }
+        };
+        read_entries(yaml["publishes"], publishes);
+        read_entries(yaml["subscribes"], subscribes);
+
+        for (auto thread_node : yaml["bases"])
+        {
+            auto& thread_bases = bases[thread_node["thread"].as<std::string>()];
+            for (auto base : thread_node["bases"]) thread_bases.insert(base.as<std::string>());
+        }
+
+        auto types_node = yaml["types"];
+        for (auto it = types_node.begin(), end = types_node.end(); it != end; ++it)
+            types.emplace(it->first.as<std::string>(), TypeLayout(it->second));
+    }
+
+    void write_yaml(YAML::Emitter& yaml_out) const
+    {
+        goby::yaml::YMap fragment_map(yaml_out);
+
+        auto write_entries = [&](const std::set<PubSubEntry>& entries) {
+            goby::yaml::YMap layer_map(yaml_out);
+            // UNKNOWN too (e.g. InterModule), so merging fragments finds what -gen would
+            for (auto layer :
+                 {Layer::UNKNOWN, Layer::INTERTHREAD, Layer::INTERPROCESS, Layer::INTERVEHICLE})
+            {
+                layer_map.add_key(to_string(layer));
+                goby::yaml::YSeq entry_seq(yaml_out);
+                for (const auto& e : entries)
+                {
+                    if (e.layer == layer)
+                        e.write_yaml_map(yaml_out);
+                }
+            }
+        };
+
+        fragment_map.add_key("publishes");
+        write_entries(publishes);
+        fragment_map.add_key("subscribes");
+        write_entries(subscribes);
+
+        {
+            fragment_map.add_key("bases");
+            goby::yaml::YSeq thread_seq(yaml_out);
+            for (const auto& bases_p : bases)
+            {
+                goby::yaml::YMap thread_map(yaml_out);
+                thread_map.add("thread", bases_p.first);
+                thread_map.add_key("bases");
+                goby::yaml::YSeq bases_seq(yaml_out, true);
+                for (const auto& base : bases_p.second) bases_seq.add(base);
+            }
+        }
+
+        if (!types.empty())
+        {
+            fragment_map.add_key("types");
+            write_types(yaml_out);
+        }
+    }
+
+    // the types map of an interface or fragment file
+    void write_types(YAML::Emitter& yaml_out) const
+    {
+        goby::yaml::YMap types_map(yaml_out);
+        for (const auto& type_p : types)
+        {
+            types_map.add_key(type_p.first);
+            type_p.second.write_yaml_map(yaml_out);
+        }
+    }
+
+    void merge(const InterfaceFragment& other)
+    {
+        for (const auto& e : other.publishes) insert_merged(publishes, e);
+        for (const auto& e : other.subscribes) insert_merged(subscribes, e);
+        // a given thread always has the same bases, so the union is the same as the serial result
+        for (const auto& bases_p : other.bases)
+            bases[bases_p.first].insert(bases_p.second.begin(), bases_p.second.end());
+        // a given type always has the same layout
+        types.insert(other.types.begin(), other.types.end());
+    }
+
+    std::set<PubSubEntry> publishes;
+    std::set<PubSubEntry> subscribes;
+    // map thread to bases
+    std::map<std::string, std::set<std::string>> bases;
+    // layout of each CXX_OBJECT type published or subscribed
+    std::map<std::string, TypeLayout> types;
+};
+} // namespace clang
+} // namespace goby
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef INTERFACE_READER_20191215H
+#define INTERFACE_READER_20191215H
+
+#include <istream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <yaml-cpp/eventhandler.h>
+#include <yaml-cpp/parser.h>
+#include <yaml-cpp/yaml.h>
+
+#include "pubsub_entry.h"
+#include "type_layout.h"
+
+namespace goby
+{
+namespace clang
+{
+// Reads an interface file (as written by -gen) straight from the parser events, without
+// building a YAML::Node tree. Keys that aren't part of the interface are skipped.
+class InterfaceReader : public YAML::EventHandler
+{
+  public:
+    struct Entry
+    {
+        // thread is only used if given in the file (has_thread)
+        PubSubEntry to_entry(Layer layer, Symbol default_thread) const
+        {
+            PubSubEntry e(layer, has_thread ? Symbol(thread) : default_thread, group, scheme,
+                          type);
+            e.is_inner_pub = inner;
+            e.rates = rates;
+            e.size = size;
+            e.copies = copies;
+            return e;
+        }
+
+        std::string thread;
+        bool has_thread{false};
+        std::string group;
+        std::string scheme;
+        std::string type;
+        bool inner{false};
+        std::map<std::string, std::string> rates;
+        long size{-1};
+        std::set<std::string> copies;
+    };
+
+    struct Thread
+    {
+        std::string name;
+        std::set<std::string> bases;
+        std::vector<Entry> publishes;
+        std::vector<Entry> subscribes;
+    };
+
+    // reads the first document of is (throws YAML::Exception or std::runtime_error if it isn't
+    // an interface)
+    explicit InterfaceReader(std::istream& is)
+    {
+        YAML::Parser parser(is);
+        parser.HandleNextDocument(*this);
+        if (!has_application_)
+            throw std::runtime_error("no application: in interface file");
+    }
+
+    std::string application;
+    std::vector<Thread> threads;
+    std::vector<Entry> interprocess_publishes;
+    std::vector<Entry> interprocess_subscribes;
+    std::vector<Entry> intervehicle_publishes;
+    std::vector<Entry> intervehicle_subscribes;
+    std::map<std::string, TypeLayout> types;
+
+    void OnDocumentStart(const YAML::Mark&) override {}
+    void OnDocumentEnd() override {}
+
+    void OnNull(const YAML::Mark&, YAML::anchor_t) override { on_value(std::string()); }
+    void OnAlias(const YAML::Mark&, YAML::anchor_t) override
+    {
+        throw std::runtime_error("aliases are not supported in interface files");
+    }
+    void OnScalar(const YAML::Mark&, const std::string&, YAML::anchor_t,
+                  const std::string& value) override
+    {
+        on_value(value);
+    }
+
+    void OnSequenceStart(const YAML::Mark&, const std::string&, YAML::anchor_t,
+                         YAML::EmitterStyle::value) override
+    {
+        start(false);
+    }
+    void OnSequenceEnd() override { end(); }
+
+    void OnMapStart(const YAML::Mark&, const std::string&, YAML::anchor_t,
+                    YAML::EmitterStyle::value) override
+    {
+        start(true);
+    }
+    void OnMapEnd() override { end(); }
+
+  private:
+    // where in an interface file a map or sequence is
+    enum class Context
+    {
+        OTHER,
+        ROOT,
+        INTERTHREAD,
+        THREADS,
+        THREAD,
+        BASES,
+        LAYER,
+        ENTRIES,
+        ENTRY,
+        RATES,
+        COPIES,
+        TYPES,
+        TYPE,
+        TYPE_MEMBERS
+    };
+
+    struct Container
+    {
+        Context context;
+        bool is_map;
+        // for maps: the next scalar is a key (else the value of key)
+        bool expect_key{true};
+        std::string key;
+        // this container is itself a map key (skipped)
+        bool is_key{false};
+        // for LAYER and THREAD: where their publishes and subscribes go
+        std::vector<Entry>* publishes{nullptr};
+        std::vector<Entry>* subscribes{nullptr};
+        // for ENTRIES: where its entries go
+        std::vector<Entry>* entries{nullptr};
+        // for TYPE and TYPE_MEMBERS: the layout being read and where the members go
+        TypeLayout* type{nullptr};
+        std::vector<std::string>* members{nullptr};
+    };
+
+    void start(bool is_map)
+    {
+        Container container{is_map ? Context::ROOT : Context::OTHER, is_map};
+        if (!stack_.empty())
+        {
+            const auto& parent = stack_.back();
+            container.is_key = parent.is_map && parent.expect_key;
+            std::string key = parent.is_map ? parent.key : std::string();
+            container.context = Context::OTHER;
+            if (container.is_key)
+                key.clear();
+            switch (parent.context)
+            {
+                case Context::ROOT:
+                    if (is_map && key == "interthread")
+                    {
+                        container.context = Context::INTERTHREAD;
+                    }
+                    else if (is_map && key == "interprocess")
+                    {
+                        container.context = Context::LAYER;
+                        container.publishes = &interprocess_publishes;
+                        container.subscribes = &interprocess_subscribes;
+                    }
+                    else if (is_map && key == "intervehicle")
+                    {
+                        container.context = Context::LAYER;
+                        container.publishes = &intervehicle_publishes;
+                        container.subscribes = &intervehicle_subscribes;
+                    }
+                    else if (is_map && key == "types")
+                    {
+                        container.context = Context::TYPES;
+                    }
+                    break;
+                case Context::TYPES:
+                    if (is_map && !key.empty())
+                    {
+                        container.context = Context::TYPE;
+                        container.type = &types[key];
+                    }
+                    break;
+                case Context::TYPE:
+                    if (!is_map && (key == "straddling" || key == "shared_atomics" ||
+                                    key == "non_trivially_copyable"))
+                    {
+                        container.context = Context::TYPE_MEMBERS;
+                        auto* type = parent.type;
+                        if (key == "straddling")
+                            container.members = &type->straddling;
+                        else if (key == "shared_atomics")
+                            container.members = &type->shared_atomics;
+                        else
+                            container.members = &type->non_trivially_copyable;
+                    }
+                    break;
+                case Context::INTERTHREAD:
+                    if (!is_map && key == "threads")
+                        container.context = Context::THREADS;
+                    break;
+                case Context::THREADS:
+                    if (is_map)
+                    {
+                        container.context = Context::THREAD;
+                        threads.emplace_back();
+                        container.publishes = &threads.back().publishes;
+                        container.subscribes = &threads.back().subscribes;
+                        thread_has_name_ = false;
+                    }
+                    break;
+                case Context::THREAD:
+                case Context::LAYER:
+                    if (!is_map && key == "bases" && parent.context == Context::THREAD)
+                    {
+                        container.context = Context::BASES;
+                    }
+                    else if (!is_map && (key == "publishes" || key == "subscribes"))
+                    {
+                        container.context = Context::ENTRIES;
+                        container.entries =
+                            key == "publishes" ? parent.publishes : parent.subscribes;
+                    }
+                    break;
+                case Context::ENTRIES:
+                    if (is_map)
+                    {
+                        container.context = Context::ENTRY;
+                        entry_ = Entry();
+                        seen_ = 0;
+                    }
+                    break;
+                case Context::ENTRY:
+                    if (is_map && key == "rates")
+                        container.context = Context::RATES;
+                    else if (!is_map && key == "copies")
+                        container.context = Context::COPIES;
+                    break;
+                default: break;
+            }
+        }
+        stack_.push_back(container);
+    }
+
+    void end()
+    {
+        auto container = std::move(stack_.back());
+        stack_.pop_back();
+
+        if (container.context == Context::ENTRY)
+        {
+            if ((seen_ & (GROUP | SCHEME | TYPE)) != (GROUP | SCHEME | TYPE))
+                throw std::runtime_error("interface entry without group, scheme and type");
+            stack_.back().entries->push_back(entry_);
+        }
+        else if (container.context == Context::THREAD && !thread_has_name_)
+        {
+            throw std::runtime_error("interface thread without name");
+        }
+
+        if (stack_.empty())
+            return;
+
+        // a key that is a container can't be one of ours, so its value is skipped
+        if (container.is_key)
+        {
+            stack_.back().key.clear();
+            stack_.back().expect_key = false;
+        }
+        else
+        {
+            value_done();
+        }
+    }
+
+    void on_value(const std::string& value)
+    {
+        if (stack_.empty())
+            return;
+
+        auto& container = stack_.back();
+        if (container.is_map && container.expect_key)
+        {
+            container.key = value;
+            container.expect_key = false;
+            return;
+        }
+
+        const auto& key = container.key;
+        switch (container.context)
+        {
+            case Context::ROOT:
+                if (key == "application")
+                {
+                    application = value;
+                    has_application_ = true;
+                }
+                break;
+            case Context::THREAD:
+                if (key == "name")
+                {
+                    threads.back().name = value;
+                    thread_has_name_ = true;
+                }
+                break;
+            case Context::BASES: threads.back().bases.insert(value); break;
+            case Context::ENTRY:
+                if (key == "group")
+                {
+                    entry_.group = value;
+                    seen_ |= GROUP;
+                }
+                else if (key == "scheme")
+                {
+                    entry_.scheme = value;
+                    seen_ |= SCHEME;
+                }
+                else if (key == "type")
+                {
+                    entry_.type = value;
+                    seen_ |= TYPE;
+                }
+                else if (key == "thread")
+                {
+                    entry_.thread = value;
+                    entry_.has_thread = true;
+                }
+                else if (key == "inner")
+                {
+                    entry_.inner = YAML::Node(value).as<bool>();
+                }
+                else if (key == "size")
+                {
+                    entry_.size = YAML::Node(value).as<long>();
+                }
+                break;
+            case Context::TYPE:
+                if (key == "size")
+                    container.type->size = YAML::Node(value).as<long>();
+                else if (key == "align")
+                    container.type->align = YAML::Node(value).as<long>();
+                else if (key == "padding")
+                    container.type->padding = YAML::Node(value).as<long>();
+                break;
+            case Context::TYPE_MEMBERS: container.members->push_back(value); break;
+            case Context::RATES: entry_.rates.emplace(key, value); break;
+            case Context::COPIES: entry_.copies.insert(value); break;
+            default: break;
+        }
+        value_done();
+    }
+
+    // the value of the current map key (or a sequence item) is complete
+    void value_done()
+    {
+        auto& container = stack_.back();
+        if (container.is_map)
+            container.expect_key = true;
+    }
+
+    enum Field
+    {
+        GROUP = 1 << 0,
+        SCHEME = 1 << 1,
+        TYPE = 1 << 2
+    };
+
+    std::vector<Container> stack_;
+    bool has_application_{false};
+    // the entry being read and the required fields seen in it
+    Entry entry_;
+    int seen_{0};
+    bool thread_has_name_{false};
+};
+} // namespace clang
+} // namespace goby
+
+#endif
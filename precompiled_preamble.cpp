@@ -0,0 +1,241 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/PCHContainerOperations.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include "hash_util.h"
+#include "precompiled_preamble.h"
+#include "yaml_raii.h"
+
+using ::clang::tooling::CompileCommand;
+
+namespace
+{
+// compilation database holding just the command used to build a preamble
+class SingleCommandDatabase : public ::clang::tooling::CompilationDatabase
+{
+  public:
+    SingleCommandDatabase(CompileCommand command) : command_(std::move(command)) {}
+
+    std::vector<CompileCommand> getCompileCommands(llvm::StringRef) const override
+    {
+        return {command_};
+    }
+
+  private:
+    CompileCommand command_;
+};
+
+std::string absolute_path(const std::string& directory, const std::string& path)
+{
+    llvm::SmallString<256> absolute(path);
+    llvm::sys::fs::make_absolute(directory, absolute);
+    llvm::sys::path::remove_dots(absolute, true);
+    return absolute.str().str();
+}
+
+// compiler and flags of command, without the input file and the output and dependency file
+// arguments (which have no effect on whether a PCH can be used)
+std::vector<std::string> preamble_flags(const CompileCommand& command)
+{
+    std::vector<std::string> flags;
+    const auto& args = command.CommandLine;
+    const auto input = absolute_path(command.Directory, command.Filename);
+    for (std::size_t i = 0, n = args.size(); i < n; ++i)
+    {
+        const auto& arg = args[i];
+        if (arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ")
+            ++i;
+        else if (arg == "-c" || arg == "-M" || arg == "-MM" || arg == "-MD" || arg == "-MMD" ||
+                 arg == "-MP" || arg.compare(0, 3, "-MF") == 0 || arg.compare(0, 3, "-MT") == 0 ||
+                 arg.compare(0, 3, "-MQ") == 0)
+            continue;
+        else if (i > 0 && absolute_path(command.Directory, arg) == input)
+            continue;
+        else
+            flags.push_back(arg);
+    }
+    return flags;
+}
+} // namespace
+
+goby::clang::PrecompiledPreambles::PrecompiledPreambles(std::string directory,
+                                                        std::vector<std::string> headers)
+    : headers_(headers)
+{
+    // the tools run in the directory of each compile command, so this must be absolute
+    llvm::SmallString<256> absolute(directory);
+    llvm::sys::fs::make_absolute(absolute);
+    directory_ = absolute.str().str();
+
+    if (auto ec = llvm::sys::fs::create_directories(directory_))
+        std::cerr << "Failed to create preamble directory " << directory_ << ": " << ec.message()
+                  << std::endl;
+}
+
+std::string goby::clang::PrecompiledPreambles::get(const CompileCommand& command)
+{
+    auto flags = preamble_flags(command);
+
+    // the translation unit already uses its own PCH (e.g. CMake precompiled headers)
+    for (const auto& flag : flags)
+    {
+        if (flag == "-include-pch")
+            return "";
+    }
+
+    std::string signature = ::clang::getClangFullVersion() + '\0' + command.Directory;
+    for (const auto& flag : flags) signature += '\0' + flag;
+    for (const auto& header : headers_) signature += '\n' + header;
+    const auto key = md5_hex(signature);
+
+    std::shared_ptr<Preamble> preamble;
+    {
+        std::lock_guard<std::mutex> lock(preambles_mutex_);
+        auto& preamble_p = preambles_[key];
+        if (!preamble_p)
+            preamble_p = std::make_shared<Preamble>();
+        preamble = preamble_p;
+    }
+
+    // other translation units with the same flags wait here while the first one builds it
+    std::call_once(preamble->built, [&]() { build(*preamble, key, command, flags); });
+
+    if (preamble->pch.empty() || preamble->invalid)
+        return "";
+
+    ++preamble->uses;
+    return preamble->pch;
+}
+
+void goby::clang::PrecompiledPreambles::build(Preamble& preamble, const std::string& key,
+                                              const CompileCommand& command,
+                                              const std::vector<std::string>& flags)
+{
+    const auto header = directory_ + "/" + key + ".h";
+    const auto pch = directory_ + "/" + key + ".pch";
+    const auto info = directory_ + "/" + key + ".yml";
+
+    // reuse one built by a previous run; clang itself rejects it if any of its headers changed
+    if (llvm::sys::fs::exists(pch) && llvm::sys::fs::exists(info))
+    {
+        try
+        {
+            auto build_seconds = YAML::LoadFile(info)["build_seconds"].as<double>();
+            publish(preamble, pch, build_seconds, false);
+            return;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Rebuilding preamble with invalid " << info << ": " << e.what()
+                      << std::endl;
+        }
+    }
+
+    {
+        std::ofstream header_ofs(header.c_str());
+        for (const auto& h : headers_) header_ofs << "#include <" << h << ">\n";
+        if (!header_ofs)
+        {
+            std::cerr << "Failed to write " << header << std::endl;
+            return;
+        }
+    }
+
+    auto args = flags;
+    args.insert(args.end(), {"-x", "c++-header", header, "-o", pch});
+    SingleCommandDatabase database(CompileCommand(command.Directory, header, args, pch));
+    ::clang::tooling::ClangTool tool(database, {header},
+                                     std::make_shared<::clang::PCHContainerOperations>(),
+                                     llvm::vfs::createPhysicalFileSystem());
+    // keep the output file and don't add -fsyntax-only
+    tool.clearArgumentsAdjusters();
+
+    auto start = std::chrono::steady_clock::now();
+    int retval =
+        tool.run(::clang::tooling::newFrontendActionFactory<::clang::GeneratePCHAction>().get());
+    std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start;
+
+    if (retval != 0 || !llvm::sys::fs::exists(pch))
+    {
+        std::cerr << "Failed to build preamble for the flags of " << command.Filename
+                  << ", parsing without it" << std::endl;
+        return;
+    }
+
+    publish(preamble, pch, build_time.count(), true);
+
+    YAML::Emitter yaml_out;
+    {
+        goby::yaml::YMap info_map(yaml_out);
+        info_map.add("build_seconds", build_time.count());
+    }
+    std::ofstream info_ofs(info.c_str());
+    info_ofs << yaml_out.c_str();
+}
+
+void goby::clang::PrecompiledPreambles::publish(Preamble& preamble, const std::string& pch,
+                                                double build_seconds, bool built_this_run)
+{
+    std::lock_guard<std::mutex> lock(preambles_mutex_);
+    preamble.pch = pch;
+    preamble.build_seconds = build_seconds;
+    preamble.built_this_run = built_this_run;
+}
+
+void goby::clang::PrecompiledPreambles::invalidate(const std::string& pch)
+{
+    std::lock_guard<std::mutex> lock(preambles_mutex_);
+    for (auto& preamble_p : preambles_)
+    {
+        auto& preamble = *preamble_p.second;
+        if (preamble.pch != pch)
+            continue;
+
+        --preamble.uses;
+        if (!preamble.invalid.exchange(true))
+        {
+            llvm::sys::fs::remove(pch);
+            llvm::sys::fs::remove(directory_ + "/" + preamble_p.first + ".yml");
+        }
+    }
+}
+
+void goby::clang::PrecompiledPreambles::report(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> lock(preambles_mutex_);
+    int translation_units = 0, built = 0, reused = 0;
+    double build_seconds = 0, saved_seconds = 0;
+    for (const auto& preamble_p : preambles_)
+    {
+        const auto& preamble = *preamble_p.second;
+        if (preamble.pch.empty())
+            continue;
+
+        translation_units += preamble.uses;
+        // each use avoids parsing the headers again, but building the PCH is not free
+        saved_seconds += preamble.uses * preamble.build_seconds;
+        if (preamble.built_this_run)
+        {
+            ++built;
+            build_seconds += preamble.build_seconds;
+            saved_seconds -= preamble.build_seconds;
+        }
+        else
+        {
+            ++reused;
+        }
+    }
+
+    os << "Precompiled preambles: " << translation_units << " translation units used "
+       << built + reused << " preamble(s) (" << built << " built in " << build_seconds << " s, "
+       << reused << " reused); header parse time saved: about " << saved_seconds
+       << " s (an estimate from the preamble build times, not measured)" << std::endl;
+}
@@ -0,0 +1,69 @@
+#ifndef PRECOMPILED_PREAMBLE_20191215H
+#define PRECOMPILED_PREAMBLE_20191215H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "clang/Tooling/CompilationDatabase.h"
+
+namespace goby
+{
+namespace clang
+{
+// Precompiled headers of the heavy goby middleware headers that nearly every translation unit
+// includes. One is built (or reused from the directory) for each distinct set of compile flags and
+// then loaded with -include-pch by every translation unit compiled with those flags.
+class PrecompiledPreambles
+{
+  public:
+    PrecompiledPreambles(std::string directory, std::vector<std::string> headers);
+
+    // path to the PCH compatible with command, building it on first use; empty if unavailable
+    std::string get(const ::clang::tooling::CompileCommand& command);
+
+    // a translation unit failed with the given PCH but parsed without it (e.g. the PCH is stale),
+    // so stop using it and remove it so that the next run rebuilds it
+    void invalidate(const std::string& pch);
+
+    // summary of the preambles used and an estimate of the parse time they saved
+    void report(std::ostream& os) const;
+
+  private:
+    struct Preamble
+    {
+        std::once_flag built;
+        // these three are set once by build() under preambles_mutex_, since invalidate() and
+        // report() read every preamble while others may still be building
+        std::string pch;
+        // seconds taken to build the PCH, which approximates the time spent parsing the same
+        // headers in each translation unit without it
+        double build_seconds{0};
+        bool built_this_run{false};
+        std::atomic<bool> invalid{false};
+        std::atomic<int> uses{0};
+    };
+
+    void build(Preamble& preamble, const std::string& key,
+               const ::clang::tooling::CompileCommand& command,
+               const std::vector<std::string>& flags);
+    // set the results of build()
+    void publish(Preamble& preamble, const std::string& pch, double build_seconds,
+                 bool built_this_run);
+
+  private:
+    std::string directory_;
+    std::vector<std::string> headers_;
+
+    mutable std::mutex preambles_mutex_;
+    // key is a hash of the compatible flags
+    std::map<std::string, std::shared_ptr<Preamble>> preambles_;
+};
+} // namespace clang
+} // namespace goby
+
+#endif
@@ -0,0 +1,247 @@
+#include <cctype>
+#include <cstring>
+#include <set>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include "prefilter.h"
+
+namespace
+{
+bool is_identifier_start(char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_'; }
+bool is_identifier_char(char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+
+std::string absolute_path(const std::string& directory, const std::string& path)
+{
+    llvm::SmallString<256> absolute(path);
+    llvm::sys::fs::make_absolute(directory, absolute);
+    llvm::sys::path::remove_dots(absolute, true);
+    return absolute.str().str();
+}
+} // namespace
+
+goby::clang::TransporterPrefilter::Scan
+goby::clang::TransporterPrefilter::scan_text(const std::string& text)
+{
+    Scan scan;
+    const std::size_t n = text.size();
+    // only whitespace since the last newline, so a '#' starts a directive
+    bool line_start = true;
+
+    auto skip_space = [&](std::size_t& i) {
+        while (i < n && (text[i] == ' ' || text[i] == '\t')) ++i;
+    };
+
+    std::size_t i = 0;
+    while (i < n)
+    {
+        const char c = text[i];
+        if (c == '\n')
+        {
+            line_start = true;
+            ++i;
+        }
+        else if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            ++i;
+        }
+        else if (c == '/' && i + 1 < n && text[i + 1] == '/')
+        {
+            while (i < n && text[i] != '\n') ++i;
+        }
+        else if (c == '/' && i + 1 < n && text[i + 1] == '*')
+        {
+            auto end = text.find("*/", i + 2);
+            i = (end == std::string::npos) ? n : end + 2;
+        }
+        else if (c == '#' && i + 1 < n && text[i + 1] == '#')
+        {
+            scan.mentions_transporter = true;
+            line_start = false;
+            i += 2;
+        }
+        else if (c == '#' && line_start)
+        {
+            ++i;
+            skip_space(i);
+            auto directive_begin = i;
+            while (i < n && is_identifier_char(text[i])) ++i;
+            std::string directive = text.substr(directive_begin, i - directive_begin);
+            line_start = false;
+
+            if (directive == "include" || directive == "include_next" || directive == "import")
+            {
+                skip_space(i);
+                char close = 0;
+                if (i < n && text[i] == '"')
+                    close = '"';
+                else if (i < n && text[i] == '<')
+                    close = '>';
+
+                auto name_end = close ? text.find_first_of(std::string(1, close) + "\n", i + 1)
+                                      : std::string::npos;
+                if (name_end == std::string::npos || text[name_end] != close)
+                {
+                    scan.computed_include = true;
+                }
+                else
+                {
+                    scan.includes.emplace_back(text.substr(i + 1, name_end - i - 1), close == '>');
+                    i = name_end + 1;
+                }
+            }
+        }
+        else if (c == '"' || c == '\'')
+        {
+            // string or character literal
+            ++i;
+            while (i < n && text[i] != c && text[i] != '\n')
+            {
+                if (text[i] == '\\')
+                    ++i;
+                ++i;
+            }
+            ++i;
+            line_start = false;
+        }
+        else if (std::isdigit(static_cast<unsigned char>(c)))
+        {
+            // pp-number, including digit separators (1'000) and exponents (1e+3)
+            while (i < n && (is_identifier_char(text[i]) || text[i] == '.' || text[i] == '\'' ||
+                             ((text[i] == '+' || text[i] == '-') &&
+                              std::strchr("eEpP", text[i - 1]))))
+                ++i;
+            line_start = false;
+        }
+        else if (is_identifier_start(c))
+        {
+            auto begin = i;
+            while (i < n && is_identifier_char(text[i])) ++i;
+            std::string identifier = text.substr(begin, i - begin);
+            line_start = false;
+
+            if (identifier == "publish" || identifier == "subscribe")
+            {
+                scan.mentions_transporter = true;
+            }
+            else if (i < n && text[i] == '"' && identifier.back() == 'R' &&
+                     (identifier == "R" || identifier == "u8R" || identifier == "uR" ||
+                      identifier == "UR" || identifier == "LR"))
+            {
+                // raw string literal: R"delim( ... )delim"
+                auto paren = text.find('(', i);
+                if (paren == std::string::npos)
+                    break;
+                auto close = ")" + text.substr(i + 1, paren - i - 1) + "\"";
+                auto end = text.find(close, paren);
+                i = (end == std::string::npos) ? n : end + close.size();
+            }
+        }
+        else
+        {
+            line_start = false;
+            ++i;
+        }
+    }
+    return scan;
+}
+
+std::shared_ptr<const goby::clang::TransporterPrefilter::Scan>
+goby::clang::TransporterPrefilter::scan_file(const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(scans_mutex_);
+        auto it = scans_.find(path);
+        if (it != scans_.end())
+            return it->second;
+    }
+
+    std::shared_ptr<const Scan> scan;
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (buffer)
+        scan = std::make_shared<const Scan>(scan_text((*buffer)->getBuffer().str()));
+
+    std::lock_guard<std::mutex> lock(scans_mutex_);
+    scans_[path] = scan;
+    return scan;
+}
+
+bool goby::clang::TransporterPrefilter::may_match(const std::string& directory,
+                                                  const std::string& file,
+                                                  const std::vector<std::string>& command_line)
+{
+    std::vector<std::string> quote_dirs, project_dirs;
+    std::vector<std::string> pending{absolute_path(directory, file)};
+
+    for (std::size_t i = 1, n = command_line.size(); i < n; ++i)
+    {
+        const auto& arg = command_line[i];
+        std::string value;
+        // option with a joined (-Idir) or separate (-I dir) value
+        auto option = [&](const std::string& name) {
+            if (arg == name && i + 1 < n)
+                value = command_line[++i];
+            else if (arg.size() > name.size() && arg.compare(0, name.size(), name) == 0)
+                value = arg.substr(name.size());
+            else
+                return false;
+            value = absolute_path(directory, value);
+            return true;
+        };
+
+        // contents we can't see from the source text
+        if (arg == "-include-pch" || arg == "-imacros")
+            return true;
+        else if (option("-iquote"))
+            quote_dirs.push_back(value);
+        else if (option("-I"))
+            project_dirs.push_back(value);
+        else if (option("-include"))
+            pending.push_back(value);
+    }
+
+    std::set<std::string> visited;
+    while (!pending.empty())
+    {
+        auto path = pending.back();
+        pending.pop_back();
+        if (!visited.insert(path).second)
+            continue;
+
+        auto scan = scan_file(path);
+        if (!scan || scan->mentions_transporter || scan->computed_include)
+            return true;
+
+        for (const auto& include_p : scan->includes)
+        {
+            const auto& name = include_p.first;
+            bool angled = include_p.second;
+            if (is_goby_io_thread_header(name))
+                return true;
+
+            std::vector<std::string> search_dirs;
+            if (!angled)
+            {
+                search_dirs.push_back(llvm::sys::path::parent_path(path).str());
+                search_dirs.insert(search_dirs.end(), quote_dirs.begin(), quote_dirs.end());
+            }
+            search_dirs.insert(search_dirs.end(), project_dirs.begin(), project_dirs.end());
+
+            for (const auto& dir : search_dirs)
+            {
+                auto header = absolute_path(dir, name);
+                if (llvm::sys::fs::is_regular_file(header))
+                {
+                    if (!is_goby_middleware_header(header))
+                        pending.push_back(header);
+                    break;
+                }
+            }
+            // not found in a project directory, so a system header without project code
+        }
+    }
+
+    return false;
+}
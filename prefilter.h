@@ -0,0 +1,66 @@
+#ifndef PREFILTER_20191215H
+#define PREFILTER_20191215H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace goby
+{
+namespace clang
+{
+// goby's own transporter and thread headers, which the prefilter doesn't scan (nearly all of them
+// mention publish/subscribe)
+inline bool is_goby_middleware_header(const std::string& path)
+{
+    return path.find("/goby/middleware/") != std::string::npos;
+}
+
+// goby's I/O thread templates, which publish and subscribe on the groups they are instantiated
+// with. generate() matches the calls in them like those in project code, so a translation unit
+// including one may match without mentioning publish/subscribe.
+inline bool is_goby_io_thread_header(const std::string& path)
+{
+    return path.find("goby/middleware/io/") != std::string::npos;
+}
+
+// Fast token-level check of whether a translation unit could possibly contain a publish or
+// subscribe call, so that translation units that can't are never parsed. Scans the main file,
+// forced includes and the project headers they include (those found in the includer's directory
+// or an -iquote/-I directory), skipping comments and string literals. It is conservative: anything
+// it can't follow (unreadable files, macro includes, token pasting, -include-pch) and any goby I/O
+// thread include means the translation unit may match.
+class TransporterPrefilter
+{
+  public:
+    // directory, file and command_line as in a clang::tooling::CompileCommand
+    bool may_match(const std::string& directory, const std::string& file,
+                   const std::vector<std::string>& command_line);
+
+    // tokens of interest in a single file
+    struct Scan
+    {
+        // names publish/subscribe, or uses token pasting that could form them
+        bool mentions_transporter{false};
+        // #include with a macro instead of a file name
+        bool computed_include{false};
+        // file name and whether it was <angled> (otherwise "quoted")
+        std::vector<std::pair<std::string, bool>> includes;
+    };
+
+    static Scan scan_text(const std::string& text);
+
+  private:
+    // memoized, since project headers are shared by many translation units; null if unreadable
+    std::shared_ptr<const Scan> scan_file(const std::string& path);
+
+  private:
+    std::mutex scans_mutex_;
+    std::map<std::string, std::shared_ptr<const Scan>> scans_;
+};
+} // namespace clang
+} // namespace goby
+
+#endif
@@ -1,8 +1,12 @@
 #ifndef PUBSUB_ENTRY_20190801H
 #define PUBSUB_ENTRY_20190801H
 
+#include <map>
+#include <set>
 #include <string>
+#include <unordered_map>
 
+#include "symbol.h"
 #include "yaml_raii.h"
 
 namespace viz
@@ -22,49 +26,103 @@ enum class Layer
     INTERVEHICLE = 2
 };
 
-struct PubSubEntry
+inline std::string to_string(Layer layer)
+{
+    switch (layer)
+    {
+        case Layer::INTERTHREAD: return "interthread";
+        case Layer::INTERPROCESS: return "interprocess";
+        case Layer::INTERVEHICLE: return "intervehicle";
+        default: return "unknown";
+    }
+}
+
+inline Layer layer_from_string(const std::string& str)
 {
-    PubSubEntry(Layer l, const YAML::Node& yaml,
-                const std::map<std::string, std::shared_ptr<viz::Thread>> threads);
+    for (auto layer : {Layer::INTERTHREAD, Layer::INTERPROCESS, Layer::INTERVEHICLE})
+    {
+        if (str == to_string(layer))
+            return layer;
+    }
+    return Layer::UNKNOWN;
+}
+
+// maps each thread name to the most derived thread that has it as a base (see viz::Application)
+using MostDerivedThreads = std::unordered_map<Symbol, Symbol>;
 
+struct PubSubEntry
+{
     PubSubEntry(Layer l, const YAML::Node& yaml, const std::string& th = "")
+        : layer(l),
+          thread(yaml["thread"] ? yaml["thread"].as<std::string>() : th),
+          group(yaml["group"].as<std::string>()),
+          scheme(yaml["scheme"].as<std::string>()),
+          type(yaml["type"].as<std::string>()),
+          is_inner_pub(yaml["inner"] && yaml["inner"].as<bool>()),
+          size(yaml["size"] ? yaml["size"].as<long>() : -1)
     {
-        layer = l;
-        auto thread_node = yaml["thread"];
-        if (thread_node)
-            thread = thread_node.as<std::string>();
-        else
-            thread = th;
-
-        group = yaml["group"].as<std::string>();
-        scheme = yaml["scheme"].as<std::string>();
-        type = yaml["type"].as<std::string>();
-        auto inner_node = yaml["inner"];
-        if (inner_node && inner_node.as<bool>())
-            is_inner_pub = true;
+        auto rates_node = yaml["rates"];
+        if (rates_node)
+        {
+            for (auto rate : rates_node)
+                rates.emplace(rate.first.as<std::string>(), rate.second.as<std::string>());
+        }
+
+        auto copies_node = yaml["copies"];
+        if (copies_node)
+        {
+            for (auto copy : copies_node) copies.insert(copy.as<std::string>());
+        }
+        auto blocking_node = yaml["blocking"];
+        if (blocking_node)
+        {
+            for (auto chain : blocking_node) blocking.insert(chain.as<std::string>());
+        }
     }
 
-    PubSubEntry(Layer l, std::string th, std::string g, std::string s, std::string t)
+    PubSubEntry(Layer l, Symbol th, Symbol g, Symbol s, Symbol t)
         : layer(l), thread(th), group(g), scheme(s), type(t)
     {
     }
 
     Layer layer{Layer::UNKNOWN};
-    std::string thread;
+    Symbol thread;
 
-    std::string group;
-    std::string scheme;
-    std::string type;
+    Symbol group;
+    Symbol scheme;
+    Symbol type;
 
     void write_yaml_map(YAML::Emitter& yaml_out, bool include_thread = true,
                         bool inner_pub = false) const
     {
         goby::yaml::YMap entry_map(yaml_out, false);
-        entry_map.add("group", group);
-        entry_map.add("scheme", scheme);
-        entry_map.add("type", type);
+        entry_map.add("group", group.str());
+        entry_map.add("scheme", scheme.str());
+        entry_map.add("type", type.str());
         if (include_thread)
-            entry_map.add("thread", thread);
+            entry_map.add("thread", thread.str());
+
+        if (!rates.empty())
+        {
+            entry_map.add_key("rates");
+            goby::yaml::YMap rates_map(yaml_out);
+            for (const auto& rate_p : rates) rates_map.add(rate_p.first, rate_p.second);
+        }
+
+        if (size >= 0)
+            entry_map.add("size", size);
+        if (!copies.empty())
+        {
+            entry_map.add_key("copies");
+            goby::yaml::YSeq copies_seq(yaml_out);
+            for (const auto& copy : copies) copies_seq.add(copy);
+        }
+        if (!blocking.empty())
+        {
+            entry_map.add_key("blocking");
+            goby::yaml::YSeq blocking_seq(yaml_out);
+            for (const auto& chain : blocking) blocking_seq.add(chain);
+        }
 
         // publication was automatically added to this scope from an outer publisher
         if (inner_pub)
@@ -72,8 +130,38 @@ struct PubSubEntry
     }
 
     bool is_inner_pub{false};
+
+    // publications only: the estimated rate of the publish() call at each call site
+    // ("file:line:column"), as an expression (see generate.cpp). Not part of the ordering, so equal
+    // entries from different call sites are combined by insert_merged()
+    mutable std::map<std::string, std::string> rates;
+
+    // interthread only: the size of type in bytes (its sizeof, so not including anything it
+    // owns on the heap; -1 if unknown) and the call sites that copy it: publish() by const
+    // reference (instead of a shared_ptr) or subscribe() with a callback taking it by value
+    mutable long size{-1};
+    mutable std::set<std::string> copies;
+
+    // subscriptions only: the calls to blocking functions made by the callback, each as the chain
+    // of calls "subscribe (site) -> f (site) -> ... -> blocking (site)"
+    mutable std::set<std::string> blocking;
 };
 
+// insert e into entries, merging its call sites into an equal entry already there
+inline void insert_merged(std::set<PubSubEntry>& entries, const PubSubEntry& e)
+{
+    auto result = entries.insert(e);
+    if (!result.second)
+    {
+        const auto& existing = *result.first;
+        existing.rates.insert(e.rates.begin(), e.rates.end());
+        existing.copies.insert(e.copies.begin(), e.copies.end());
+        existing.blocking.insert(e.blocking.begin(), e.blocking.end());
+        if (existing.size < 0)
+            existing.size = e.size;
+    }
+}
+
 inline std::ostream& operator<<(std::ostream& os, const PubSubEntry& e)
 {
     return os << "layer: " << static_cast<int>(e.layer) << ", thread: " << e.thread
@@ -96,20 +184,22 @@ inline bool operator<(const PubSubEntry& a, const PubSubEntry& b)
 
 inline bool connects(const PubSubEntry& a, const PubSubEntry& b)
 {
+    static const Symbol cxx_object("CXX_OBJECT");
     return a.layer == b.layer && a.group == b.group &&
-           (a.scheme == b.scheme || a.scheme == "CXX_OBJECT" || b.scheme == "CXX_OBJECT") &&
+           (a.scheme == b.scheme || a.scheme == cxx_object || b.scheme == cxx_object) &&
            a.type == b.type;
 }
 
-inline void remove_disconnected(PubSubEntry pub, PubSubEntry sub,
+inline void remove_disconnected(const PubSubEntry& pub, const PubSubEntry& sub,
                                 std::set<PubSubEntry>& disconnected_pubs,
                                 std::set<PubSubEntry>& disconnected_subs)
 {
     disconnected_pubs.erase(pub);
     disconnected_subs.erase(sub);
 
+    static const Symbol cxx_object("CXX_OBJECT");
     auto cxx_sub = sub;
-    cxx_sub.scheme = "CXX_OBJECT";
+    cxx_sub.scheme = cxx_object;
     disconnected_subs.erase(cxx_sub);
 }
 
@@ -120,52 +210,24 @@ namespace viz
 {
 struct Thread
 {
-    Thread(std::string n, std::set<std::string> b = std::set<std::string>()) : name(n), bases(b) {}
-    Thread(std::string n, const YAML::Node& y, std::set<std::string> b = std::set<std::string>())
-        : name(n), bases(b), yaml(y)
+    Thread(std::string n, std::set<std::string> b = std::set<std::string>())
+        : name(n), bases(b), most_derived_name(n)
     {
     }
 
-    void parse_yaml()
-    {
-        auto publish_node = yaml["publishes"];
-        for (auto p : publish_node)
-            interthread_publishes.emplace(goby::clang::Layer::INTERTHREAD, p, most_derived_name());
-
-        auto subscribe_node = yaml["subscribes"];
-        for (auto s : subscribe_node)
-            interthread_subscribes.emplace(goby::clang::Layer::INTERTHREAD, s, most_derived_name());
-    }
-
-    std::string most_derived_name()
-    {
-        if (parent)
-            return parent->most_derived_name();
-        else
-            return name;
-    }
-
     std::string name;
     std::set<std::string> bases;
-    YAML::Node yaml;
 
-    // child thread instance if we're not a direct base of SimpleThread
-    std::shared_ptr<Thread> child;
-    // this thread has a parent who isn't a direct base of SimpleThread
-    std::shared_ptr<Thread> parent;
+    // the thread that is actually run if this is a base of another thread that isn't a direct
+    // subclass of SimpleThread (otherwise name)
+    goby::clang::Symbol most_derived_name;
+
+    // number of thread instantiations this node stands for (see -collapse)
+    int count{1};
 
     std::set<goby::clang::PubSubEntry> interthread_publishes;
     std::set<goby::clang::PubSubEntry> interthread_subscribes;
 };
 } // namespace viz
 
-inline goby::clang::PubSubEntry::PubSubEntry(
-    Layer l, const YAML::Node& yaml,
-    const std::map<std::string, std::shared_ptr<viz::Thread>> threads)
-    : PubSubEntry(l, yaml)
-{
-    if (threads.count(thread))
-        thread = threads.at(thread)->most_derived_name();
-}
-
 #endif
@@ -0,0 +1,80 @@
+#ifndef SYMBOL_20191215H
+#define SYMBOL_20191215H
+
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+
+namespace goby
+{
+namespace clang
+{
+// Interned string: equal strings share a single entry in a process-wide table, so a Symbol is
+// one pointer to copy and equal Symbols compare by pointer. Ordering is still that of the
+// strings themselves.
+class Symbol
+{
+  public:
+    Symbol() : str_(empty_entry()) {}
+    Symbol(const std::string& str) : str_(intern(str)) {}
+    Symbol(const char* str) : str_(intern(str)) {}
+
+    const std::string& str() const { return *str_; }
+    bool empty() const { return str_->empty(); }
+
+    friend bool operator==(const Symbol& a, const Symbol& b) { return a.str_ == b.str_; }
+    friend bool operator!=(const Symbol& a, const Symbol& b) { return a.str_ != b.str_; }
+    friend bool operator<(const Symbol& a, const Symbol& b)
+    {
+        return a.str_ != b.str_ && *a.str_ < *b.str_;
+    }
+
+    // identifies the string for the lifetime of the process (for hashing)
+    const void* id() const { return str_; }
+
+  private:
+    // the entry of the empty string, kept out of the table so that the default constructor (used
+    // for every default-constructed entry and map value) never takes the lock
+    static const std::string* empty_entry()
+    {
+        static const std::string empty;
+        return &empty;
+    }
+
+    static const std::string* intern(const std::string& str)
+    {
+        if (str.empty())
+            return empty_entry();
+
+        // never shrinks; elements of an unordered_set are not moved by rehashing
+        static std::mutex mutex;
+        static std::unordered_set<std::string> table;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return &*table.insert(str).first;
+    }
+
+    const std::string* str_;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Symbol& symbol)
+{
+    return os << symbol.str();
+}
+} // namespace clang
+} // namespace goby
+
+namespace std
+{
+template <> struct hash<goby::clang::Symbol>
+{
+    std::size_t operator()(const goby::clang::Symbol& symbol) const
+    {
+        return std::hash<const void*>()(symbol.id());
+    }
+};
+} // namespace std
+
+#endif
@@ -23,14 +23,32 @@ static cl::opt<bool>
     Generate("gen",
              cl::desc("Run generate action (create YML interface files from C++ source code)"),
              cl::cat(Goby3ToolCategory));
+static cl::opt<bool> GenerateFragment(
+    "gen-fragment",
+    cl::desc("Run generate action for each source separately, writing the partial results to "
+             "{source path relative to the current directory}.interface_fragment.yml under "
+             "-outdir for a later 'merge' action"),
+    cl::cat(Goby3ToolCategory));
+static cl::opt<bool>
+    Merge("merge",
+          cl::desc("Run merge action (combine YML interface fragments from 'gen-fragment' into "
+                   "the YML interface file of a target)"),
+          cl::cat(Goby3ToolCategory));
 static cl::opt<bool> Visualize(
     "viz",
     cl::desc("Run visualize action (create GraphViz DOT files from multiple YML interface files)"),
     cl::cat(Goby3ToolCategory));
 
-static cl::opt<std::string> Target("target",
-                                   cl::desc("Specify target (binary) name for 'gen' action"),
-                                   cl::value_desc("name"), cl::cat(Goby3ToolCategory));
+static cl::opt<bool>
+    Batch("batch",
+          cl::desc("For the 'gen' action, treat the inputs as target mapping YML files (a "
+                   "'targets' sequence of 'name' and 'sources') and write {target}_interface.yml "
+                   "for every target, parsing each source once"),
+          cl::cat(Goby3ToolCategory));
+
+static cl::opt<std::string>
+    Target("target", cl::desc("Specify target (binary) name for 'gen' and 'merge' actions"),
+           cl::value_desc("name"), cl::cat(Goby3ToolCategory));
 
 static cl::opt<std::string> OutDir("outdir",
                                    cl::desc("Specify output directory for 'viz' and 'gen' actions"),
@@ -40,7 +58,7 @@ static cl::opt<std::string> OutDir("outdir",
 static cl::opt<std::string>
     OutFile("o",
             cl::desc("Specify output file name (optional, defaults to {target}_interface.yml for "
-                     "-gen and {deployment}.dot for -viz)"),
+                     "-gen and -merge and {deployment}.dot for -viz)"),
             cl::value_desc("file.[yml|dot]"), cl::cat(Goby3ToolCategory));
 
 static cl::opt<std::string>
@@ -49,6 +67,121 @@ static cl::opt<std::string>
                         "of yml files or the path to a deployment yml file"),
                cl::value_desc("name"), cl::cat(Goby3ToolCategory));
 
+static cl::opt<unsigned>
+    Jobs("j",
+         cl::desc("Number of translation units to parse in parallel for 'gen' action, or of "
+                  "interface files to load in parallel for 'viz' action (0 for one per hardware "
+                  "thread; defaults to 1 for 'gen' and 0 for 'viz')"),
+         cl::value_desc("N"), cl::init(1), cl::cat(Goby3ToolCategory));
+
+static cl::opt<bool> NoPrefilter(
+    "no-prefilter",
+    cl::desc("Parse every translation unit for the 'gen' action, even those whose source and "
+             "project headers never mention publish or subscribe"),
+    cl::cat(Goby3ToolCategory));
+
+static cl::opt<std::string>
+    CacheDir("cache-dir",
+             cl::desc("Directory for cached per-translation unit results of the 'gen' action; "
+                      "translation units whose compile command and included files are unchanged "
+                      "are not parsed again"),
+             cl::value_desc("dir"), cl::cat(Goby3ToolCategory));
+
+static cl::opt<std::string> PchDir(
+    "pch-dir",
+    cl::desc("Directory for precompiled preambles of the common goby headers for the 'gen' action; "
+             "one is built for each distinct set of compile flags and reused by later runs"),
+    cl::value_desc("dir"), cl::cat(Goby3ToolCategory));
+
+static cl::list<std::string>
+    PchHeaders("pch-header",
+               cl::desc("Header to precompile into the preamble used with -pch-dir (may be given "
+                        "more than once; defaults to the goby middleware transporter headers)"),
+               cl::value_desc("header"), cl::CommaSeparated, cl::cat(Goby3ToolCategory));
+
+static cl::opt<bool>
+    MatchProfile("match-profile",
+                 cl::desc("Print the time spent in each AST matcher for the 'gen' action"),
+                 cl::cat(Goby3ToolCategory));
+
+static cl::opt<bool>
+    GenStats("gen-stats",
+             cl::desc("Print how many translation units the 'gen' action skipped or took from "
+                      "the cache, the function bodies it reused and the preambles it used"),
+             cl::cat(Goby3ToolCategory));
+
+static cl::list<std::string> BlockingApis(
+    "blocking-api",
+    cl::desc("Qualified name (without template arguments) of a function, or of a class for all "
+             "its members, whose calls in subscribe callbacks the 'gen' action reports as "
+             "blocking (may be given more than once; replaces the default list of sleeps, file "
+             "and socket I/O, mutex locks and synchronous boost::asio calls). A name without "
+             "'::' (e.g. 'read') only matches functions declared in system headers, such as the "
+             "C library's, not a project's global functions"),
+    cl::value_desc("name"), cl::CommaSeparated, cl::cat(Goby3ToolCategory));
+
+static cl::opt<int> BlockingDepth(
+    "blocking-depth",
+    cl::desc("How many calls deep the 'gen' action follows the project functions called by a "
+             "subscribe callback looking for blocking calls"),
+    cl::value_desc("N"), cl::init(4), cl::cat(Goby3ToolCategory));
+
+static cl::opt<bool>
+    Shard("shard",
+          cl::desc("For the 'viz' action, write each platform to {output}_{platform}.dot "
+                   "(concurrently, with _2, _3, ... added to names that would otherwise be the "
+                   "same file) and only the intervehicle connections between platforms to the "
+                   "main output file; cluster numbers and node IDs are the same in every file"),
+          cl::cat(Goby3ToolCategory));
+
+static cl::opt<bool>
+    Collapse("collapse",
+             cl::desc("For the 'viz' action, draw platforms with identical applications as one "
+                      "platform and thread instantiations that differ only by an integer "
+                      "template argument as one thread, labeled with the number of each and with "
+                      "the number of connections each edge stands for"),
+             cl::cat(Goby3ToolCategory));
+
+static cl::opt<bool>
+    Watch("watch",
+          cl::desc("For the 'viz' action, keep running and write the output again whenever the "
+                   "deployment or interface files change, parsing and writing only the changed "
+                   "applications (Linux only; the cache is in memory, so each separate run still "
+                   "parses every interface file)"),
+          cl::cat(Goby3ToolCategory));
+
+static cl::opt<bool> Bandwidth(
+    "bandwidth",
+    cl::desc("For the 'viz' action, print the bytes per second of the intervehicle DCCL "
+             "publications over each platform-to-platform link (maximum encoded size times the "
+             "publication rate) and flag the links that exceed -link-capacity"),
+    cl::cat(Goby3ToolCategory));
+
+static cl::list<std::string>
+    DcclLibs("dccl-lib",
+             cl::desc("Shared library of DCCL messages (and codecs) for the message sizes of "
+                      "-bandwidth (may be given more than once)"),
+             cl::value_desc("lib.so"), cl::CommaSeparated, cl::cat(Goby3ToolCategory));
+
+static cl::opt<double>
+    LinkCapacity("link-capacity",
+                 cl::desc("Capacity of each intervehicle link for -bandwidth, in bits per second"),
+                 cl::value_desc("bps"), cl::init(0), cl::cat(Goby3ToolCategory));
+
+static cl::opt<std::string>
+    Rates("rates",
+          cl::desc("For the 'viz' action, YAML file of publication rates in Hz by group "
+                   "(\"rates: {group: hz}\"), used instead of the rates estimated by 'gen'"),
+          cl::value_desc("file.yml"), cl::cat(Goby3ToolCategory));
+
+static cl::opt<bool> CopyReport(
+    "copy-report",
+    cl::desc("For the 'viz' action, print the interthread publish() calls that pass the data by "
+             "const reference (so it is copied into a new shared_ptr) and the subscribe() "
+             "callbacks that take it by value, ranked by the bytes per second they copy (the "
+             "sizeof the type times the estimated rate)"),
+    cl::cat(Goby3ToolCategory));
+
 static cl::opt<bool>
     OmitDisconnected("no-disconnected",
                      cl::desc("Do not display arrows representing publishers without subscribers "
@@ -58,25 +191,76 @@ int main(int argc, const char** argv)
 {
     clang::tooling::CommonOptionsParser OptionsParser(argc, argv, Goby3ToolCategory);
 
-    if (Generate)
+    if (Generate || GenerateFragment)
     {
-        if (Target.empty())
+        if (Batch && GenerateFragment)
+        {
+            std::cerr << "Cannot use -batch with -gen-fragment" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (Batch && (!Target.empty() || !OutFile.empty()))
+        {
+            std::cerr << "Cannot specify -target or -o with -batch (targets are given in the "
+                         "mapping files)"
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (!Batch && !GenerateFragment && Target.empty())
         {
             std::cerr << "Must specify -target when using -gen" << std::endl;
             exit(EXIT_FAILURE);
         }
-        clang::tooling::ClangTool Tool(OptionsParser.getCompilations(),
-                                       OptionsParser.getSourcePathList());
-        return goby::clang::generate(Tool, OutDir, OutFile, Target);
+        goby::clang::GenerateOptions options;
+        options.jobs = Jobs;
+        options.prefilter = !NoPrefilter;
+        options.cache_directory = CacheDir;
+        options.pch_directory = PchDir;
+        options.pch_headers.assign(PchHeaders.begin(), PchHeaders.end());
+        options.match_profile = MatchProfile;
+        options.stats = GenStats;
+        options.blocking_apis.assign(BlockingApis.begin(), BlockingApis.end());
+        options.blocking_depth = BlockingDepth;
+        if (GenerateFragment)
+            return goby::clang::generate_fragments(OptionsParser.getCompilations(),
+                                                   OptionsParser.getSourcePathList(), OutDir,
+                                                   OutFile, options);
+        if (Batch)
+            return goby::clang::generate_batch(OptionsParser.getCompilations(),
+                                               OptionsParser.getSourcePathList(), OutDir, options);
+        return goby::clang::generate(OptionsParser.getCompilations(),
+                                     OptionsParser.getSourcePathList(), OutDir, OutFile, Target,
+                                     options);
+    }
+    else if (Merge)
+    {
+        if (Target.empty())
+        {
+            std::cerr << "Must specify -target when using -merge" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return goby::clang::merge(OptionsParser.getSourcePathList(), OutDir, OutFile, Target);
     }
     else if (Visualize)
     {
+        goby::clang::VisualizeOptions options;
+        options.omit_disconnected = OmitDisconnected;
+        options.shard = Shard;
+        options.collapse = Collapse;
+        options.watch = Watch;
+        options.bandwidth_report = Bandwidth;
+        options.dccl_libraries.assign(DcclLibs.begin(), DcclLibs.end());
+        options.link_capacity = LinkCapacity;
+        options.rates_file = Rates;
+        options.copy_report = CopyReport;
+        // unlike -gen, defaults to one per hardware thread
+        options.jobs = Jobs.getNumOccurrences() ? Jobs : 0;
         return goby::clang::visualize(OptionsParser.getSourcePathList(), OutDir, OutFile,
-                                      Deployment, OmitDisconnected);
+                                      Deployment, options);
     }
     else
     {
-        std::cerr << "Must specify an action (e.g. -gen or -viz)" << std::endl;
+        std::cerr << "Must specify an action (e.g. -gen, -gen-fragment, -merge or -viz)"
+                  << std::endl;
         exit(EXIT_FAILURE);
     }
 }
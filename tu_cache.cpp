@@ -0,0 +1,100 @@
+#include <iostream>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "tu_cache.h"
+
+namespace
+{
+// bump when the extraction changes in a way that invalidates existing entries
+const auto cache_version = "10";
+} // namespace
+
+goby::clang::TranslationUnitCache::TranslationUnitCache(std::string directory,
+                                                        std::string signature)
+    : directory_(directory), signature_(signature)
+{
+    if (auto ec = llvm::sys::fs::create_directories(directory_))
+        std::cerr << "Failed to create cache directory " << directory_ << ": " << ec.message()
+                  << std::endl;
+}
+
+std::string goby::clang::TranslationUnitCache::key(const std::string& compile_commands) const
+{
+    return md5_hex(std::string(cache_version) + '\0' + signature_ + '\0' + compile_commands);
+}
+
+std::string goby::clang::TranslationUnitCache::entry_path(const std::string& key) const
+{
+    return directory_ + "/" + key + ".yml";
+}
+
+bool goby::clang::TranslationUnitCache::load(const std::string& key, InterfaceFragment& fragment)
+{
+    if (!llvm::sys::fs::exists(entry_path(key)))
+        return false;
+
+    try
+    {
+        YAML::Node yaml = YAML::LoadFile(entry_path(key));
+        for (auto dependency : yaml["dependencies"])
+        {
+            auto hash = file_hashes_.get(dependency["file"].as<std::string>());
+            if (hash.empty() || hash != dependency["md5"].as<std::string>())
+                return false;
+        }
+        fragment = InterfaceFragment(yaml["fragment"]);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Ignoring invalid cache entry " << entry_path(key) << ": " << e.what()
+                  << std::endl;
+        return false;
+    }
+}
+
+void goby::clang::TranslationUnitCache::store(const std::string& key,
+                                              const std::vector<std::string>& dependencies,
+                                              const InterfaceFragment& fragment)
+{
+    std::map<std::string, std::string> dependency_hashes;
+    for (const auto& dependency : dependencies)
+    {
+        auto hash = file_hashes_.get(dependency);
+        // don't cache results we couldn't validate later
+        if (hash.empty())
+            return;
+        dependency_hashes[dependency] = hash;
+    }
+
+    YAML::Emitter yaml_out;
+    {
+        goby::yaml::YMap root_map(yaml_out);
+        {
+            root_map.add_key("dependencies");
+            goby::yaml::YSeq dependency_seq(yaml_out);
+            for (const auto& hash_p : dependency_hashes)
+            {
+                goby::yaml::YMap dependency_map(yaml_out, true);
+                dependency_map.add("file", hash_p.first);
+                dependency_map.add("md5", hash_p.second);
+            }
+        }
+        root_map.add_key("fragment");
+        fragment.write_yaml(yaml_out);
+    }
+
+    // write to a unique temporary and rename so that concurrent runs never see a partial entry
+    int fd;
+    llvm::SmallString<128> tmp_path;
+    if (llvm::sys::fs::createUniqueFile(directory_ + "/%%%%%%%%.tmp", fd, tmp_path))
+        return;
+    {
+        llvm::raw_fd_ostream tmp_out(fd, true);
+        tmp_out << yaml_out.c_str();
+    }
+    if (llvm::sys::fs::rename(tmp_path, entry_path(key)))
+        llvm::sys::fs::remove(tmp_path);
+}
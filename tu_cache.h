@@ -0,0 +1,44 @@
+#ifndef TU_CACHE_20191215H
+#define TU_CACHE_20191215H
+
+#include <string>
+#include <vector>
+
+#include "hash_util.h"
+#include "interface_fragment.h"
+
+namespace goby
+{
+namespace clang
+{
+// On-disk cache of the interface fragment extracted from each translation unit. Entries are found
+// by a hash of the compile command and are only valid while every file read during the original
+// parse (main file and all included headers) still has the same contents.
+class TranslationUnitCache
+{
+  public:
+    // signature: anything other than the compile command that affects the extracted fragment
+    TranslationUnitCache(std::string directory, std::string signature);
+
+    // cache key for the textual form of all the compile commands for one source file
+    std::string key(const std::string& compile_commands) const;
+
+    // returns true and sets fragment if a valid entry exists for key
+    bool load(const std::string& key, InterfaceFragment& fragment);
+
+    // dependencies: absolute paths of all the files read while parsing the translation unit
+    void store(const std::string& key, const std::vector<std::string>& dependencies,
+               const InterfaceFragment& fragment);
+
+  private:
+    std::string entry_path(const std::string& key) const;
+
+  private:
+    std::string directory_;
+    std::string signature_;
+    FileHashes file_hashes_;
+};
+} // namespace clang
+} // namespace goby
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef TYPE_LAYOUT_20191215H
+#define TYPE_LAYOUT_20191215H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "yaml_raii.h"
+
+namespace goby
+{
+namespace clang
+{
+// Memory layout of a CXX_OBJECT message type (its direct members), as found by -gen from the
+// ASTRecordLayout: interthread messages are shared between threads as C++ objects, so this is
+// what their subscribers' caches see
+struct TypeLayout
+{
+    TypeLayout() = default;
+
+    // read from a map written by write_yaml_map()
+    explicit TypeLayout(const YAML::Node& yaml)
+    {
+        size = yaml["size"].as<long>();
+        align = yaml["align"].as<long>();
+        padding = yaml["padding"].as<long>();
+        auto read_members = [&](const char* key, std::vector<std::string>& members) {
+            for (auto member : yaml[key]) members.push_back(member.as<std::string>());
+        };
+        read_members("straddling", straddling);
+        read_members("shared_atomics", shared_atomics);
+        read_members("non_trivially_copyable", non_trivially_copyable);
+    }
+
+    void write_yaml_map(YAML::Emitter& yaml_out) const
+    {
+        goby::yaml::YMap layout_map(yaml_out);
+        layout_map.add("size", size);
+        layout_map.add("align", align);
+        layout_map.add("padding", padding);
+        auto write_members = [&](const char* key, const std::vector<std::string>& members) {
+            if (members.empty())
+                return;
+            layout_map.add_key(key);
+            goby::yaml::YSeq member_seq(yaml_out, true);
+            for (const auto& member : members) member_seq.add(member);
+        };
+        write_members("straddling", straddling);
+        write_members("shared_atomics", shared_atomics);
+        write_members("non_trivially_copyable", non_trivially_copyable);
+        layout_map.add("score", score());
+    }
+
+    // 100 for a layout without any of the problems below, less 40 times the fraction of padding,
+    // 10 for each straddling member (at most 30), 15 for each shared atomic (at most 30) and 5 for
+    // each non-trivially copyable member (at most 20)
+    int score() const
+    {
+        double score = 100;
+        if (size > 0)
+            score -= 40.0 * padding / size;
+        score -= std::min<std::size_t>(30, 10 * straddling.size());
+        score -= std::min<std::size_t>(30, 15 * shared_atomics.size());
+        score -= std::min<std::size_t>(20, 5 * non_trivially_copyable.size());
+        return std::max(0, static_cast<int>(score + 0.5));
+    }
+
+    // sizeof and alignof in bytes
+    long size{0};
+    long align{0};
+    // bytes not used by any member or base (between members and at the end)
+    long padding{0};
+    // members that would fit in one cache line but are split across two
+    std::vector<std::string> straddling;
+    // std::atomic members that share a cache line with other members, as "atomic (with a, b)"
+    std::vector<std::string> shared_atomics;
+    // members that aren't trivially copyable, as "member (type)"
+    std::vector<std::string> non_trivially_copyable;
+};
+
+// bytes per cache line assumed by the layout analysis
+constexpr long cache_line_size = 64;
+} // namespace clang
+} // namespace goby
+
+#endif
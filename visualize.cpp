@@ -1,8 +1,30 @@
+#include <algorithm>
+#include <atomic>
 #include <boost/algorithm/string.hpp>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 #include "actions.h"
+#include "dccl_size.h"
+#include "hash_util.h"
+#include "interface_reader.h"
 #include "pubsub_entry.h"
 
 #include <yaml-cpp/yaml.h>
@@ -29,89 +51,101 @@ inline std::ostream& operator<<(std::ostream& os, const Thread& th)
 
 struct Application
 {
-    // create from root interface.yml node
-    Application(const YAML::Node& yaml)
+    Application() = default;
+
+    Application(const goby::clang::InterfaceReader& interface)
     {
-        name = yaml["application"].as<std::string>();
+        name = interface.application;
 
-        auto interthread_node = yaml["interthread"];
-        if (interthread_node)
+        // the interface of each thread (the first of any given more than once)
+        std::map<std::string, const goby::clang::InterfaceReader::Thread*> thread_interfaces;
+        for (const auto& thread_interface : interface.threads)
         {
-            auto threads_node = interthread_node["threads"];
-            for (auto it = threads_node.begin(), end = threads_node.end(); it != end; ++it)
-            {
-                auto thread_node = *it;
-                auto thread_name = thread_node["name"].as<std::string>();
-                auto bases_node = thread_node["bases"];
-                std::set<std::string> bases;
-                if (bases_node)
-                {
-                    for (auto base : bases_node) bases.insert(base.as<std::string>());
-                }
+            if (thread_interfaces.emplace(thread_interface.name, &thread_interface).second)
+                threads.emplace(thread_interface.name,
+                                std::make_shared<Thread>(thread_interface.name,
+                                                         thread_interface.bases));
+        }
 
-                threads.emplace(thread_name,
-                                std::make_shared<Thread>(thread_name, thread_node, bases));
+        // link threads that aren't direct subclasses of goby::middleware::SimpleThread to
+        // their bases: maps base thread name to derived thread name
+        std::map<std::string, std::string> derived;
+        for (auto& thread_p : threads)
+        {
+            auto& bases = thread_p.second->bases;
+            bool is_direct_thread_subclass = false;
+            for (const auto& base : bases)
+            {
+                if (base.find("goby::middleware::SimpleThread") == 0)
+                    is_direct_thread_subclass = true;
             }
 
-            // crosslink threads that aren't direct subclasses of goby::middleware::SimpleThread
-            for (auto& thread_p : threads)
+            if (!is_direct_thread_subclass)
             {
-                auto& bases = thread_p.second->bases;
-                bool is_direct_thread_subclass = false;
-                for (const auto base : bases)
-                {
-                    if (base.find("goby::middleware::SimpleThread") == 0)
-                        is_direct_thread_subclass = true;
-                }
-
-                if (!is_direct_thread_subclass)
+                for (const auto& base : bases)
                 {
-                    for (auto& base_thread_p : threads)
-                    {
-                        for (const auto base : bases)
-                        {
-                            if (base == base_thread_p.first)
-                            {
-                                thread_p.second->child = base_thread_p.second;
-                                base_thread_p.second->parent = thread_p.second;
-                            }
-                        }
-                    }
+                    if (threads.count(base))
+                        derived[base] = thread_p.first;
                 }
             }
-
-            // after crosslinking, actually parse the yaml
-            for (auto& thread_p : threads) { thread_p.second->parse_yaml(); }
         }
 
-        auto interprocess_node = yaml["interprocess"];
-        if (interprocess_node)
+        // flatten the links, once for each thread
+        for (auto& thread_p : threads)
         {
-            auto publish_node = interprocess_node["publishes"];
-            for (auto p : publish_node)
-                interprocess_publishes.emplace(goby::clang::Layer::INTERPROCESS, p, threads);
-
-            auto subscribe_node = interprocess_node["subscribes"];
-            for (auto s : subscribe_node)
-                interprocess_subscribes.emplace(goby::clang::Layer::INTERPROCESS, s, threads);
+            std::string most_derived = thread_p.first;
+            std::set<std::string> visited{most_derived};
+            for (auto it = derived.find(most_derived);
+                 it != derived.end() && visited.insert(it->second).second;
+                 it = derived.find(most_derived))
+                most_derived = it->second;
+
+            thread_p.second->most_derived_name = most_derived;
+            most_derived_threads.emplace(thread_p.first, most_derived);
         }
-        auto intervehicle_node = yaml["intervehicle"];
-        if (intervehicle_node)
-        {
-            auto publish_node = intervehicle_node["publishes"];
-            for (auto p : publish_node)
-                intervehicle_publishes.emplace(goby::clang::Layer::INTERVEHICLE, p, threads);
 
-            auto subscribe_node = intervehicle_node["subscribes"];
-            for (auto s : subscribe_node)
-                intervehicle_subscribes.emplace(goby::clang::Layer::INTERVEHICLE, s, threads);
+        // after resolving the most derived threads, add the interthread publications and
+        // subscriptions (to the most derived thread unless the entry names its thread)
+        using goby::clang::Layer;
+        for (auto& thread_p : threads)
+        {
+            auto& thread = *thread_p.second;
+            const auto& thread_interface = *thread_interfaces.at(thread_p.first);
+            for (const auto& p : thread_interface.publishes)
+                goby::clang::insert_merged(
+                    thread.interthread_publishes,
+                    p.to_entry(Layer::INTERTHREAD, thread.most_derived_name));
+            for (const auto& s : thread_interface.subscribes)
+                thread.interthread_subscribes.insert(
+                    s.to_entry(Layer::INTERTHREAD, thread.most_derived_name));
         }
 
+        auto insert_entries = [&](Layer layer,
+                                  const std::vector<goby::clang::InterfaceReader::Entry>& entries,
+                                  std::set<PubSubEntry>& pubsubs) {
+            for (const auto& e : entries)
+            {
+                auto pubsub = e.to_entry(layer, goby::clang::Symbol());
+                auto it = most_derived_threads.find(pubsub.thread);
+                if (it != most_derived_threads.end())
+                    pubsub.thread = it->second;
+                goby::clang::insert_merged(pubsubs, pubsub);
+            }
+        };
+        insert_entries(Layer::INTERPROCESS, interface.interprocess_publishes,
+                       interprocess_publishes);
+        insert_entries(Layer::INTERPROCESS, interface.interprocess_subscribes,
+                       interprocess_subscribes);
+        insert_entries(Layer::INTERVEHICLE, interface.intervehicle_publishes,
+                       intervehicle_publishes);
+        insert_entries(Layer::INTERVEHICLE, interface.intervehicle_subscribes,
+                       intervehicle_subscribes);
+
         auto add_threads = [&](const std::set<PubSubEntry>& pubsubs) {
             for (const auto& e : pubsubs)
             {
-                if (!threads.count(e.thread))
-                    threads.emplace(e.thread, std::make_shared<Thread>(e.thread));
+                if (!threads.count(e.thread.str()))
+                    threads.emplace(e.thread.str(), std::make_shared<Thread>(e.thread.str()));
             }
         };
 
@@ -120,14 +154,28 @@ struct Application
         add_threads(interprocess_subscribes);
         add_threads(intervehicle_publishes);
         add_threads(intervehicle_subscribes);
+
+        types = interface.types;
+    }
+
+    // the layout of the type of e if it is a CXX_OBJECT (nullptr if unknown)
+    const goby::clang::TypeLayout* type_layout(const PubSubEntry& e) const
+    {
+        static const goby::clang::Symbol cxx_object_scheme("CXX_OBJECT");
+        if (e.scheme != cxx_object_scheme)
+            return nullptr;
+        auto it = types.find(e.type.str());
+        return it == types.end() ? nullptr : &it->second;
     }
 
     std::string name;
     std::map<std::string, std::shared_ptr<Thread>> threads;
+    goby::clang::MostDerivedThreads most_derived_threads;
     std::set<PubSubEntry> interprocess_publishes;
     std::set<PubSubEntry> interprocess_subscribes;
     std::set<PubSubEntry> intervehicle_publishes;
     std::set<PubSubEntry> intervehicle_subscribes;
+    std::map<std::string, goby::clang::TypeLayout> types;
 };
 
 inline bool operator<(const Application& a, const Application& b) { return a.name < b.name; }
@@ -168,29 +216,131 @@ inline std::ostream& operator<<(std::ostream& os, const Application& a)
     return os;
 }
 
-struct Platform
+// Each distinct interface file is parsed once (concurrently) and the resulting (immutable)
+// Application shared by every platform that lists it. Reloading (for -watch) only parses the files
+// whose contents changed. The cache lives in memory only, so every -viz run starts empty.
+class ApplicationCache
 {
-    Platform(const std::string& n, const std::vector<std::string>& yamls) : name(n)
+  public:
+    // load the files not yet loaded or changed since and drop those no longer listed. On failure
+    // the errors are reported (in file order), the cache is left as it was and false returned
+    bool load(const std::set<std::string>& yaml_files, unsigned jobs)
     {
-        // each yaml represents a given application
-        for (const auto& yaml_file : yamls)
-        {
-            YAML::Node yaml;
-            try
+        std::vector<std::string> files(yaml_files.begin(), yaml_files.end());
+        std::vector<Entry> entries(files.size());
+        std::vector<std::string> errors(files.size());
+        std::atomic<std::size_t> parsed{0};
+
+        if (jobs == 0)
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+        jobs = std::min<std::size_t>(jobs, std::max<std::size_t>(1, files.size()));
+
+        // each worker pulls the next unloaded file until none remain
+        std::atomic<std::size_t> next_file{0};
+        auto run_worker = [&]() {
+            for (auto i = next_file++; i < files.size(); i = next_file++)
             {
-                yaml = YAML::LoadFile(yaml_file);
+                std::ifstream ifs(files[i].c_str());
+                if (!ifs.is_open())
+                {
+                    errors[i] = "cannot open file";
+                    continue;
+                }
+                std::stringstream contents;
+                contents << ifs.rdbuf();
+
+                auto& entry = entries[i];
+                entry.hash = goby::clang::md5_hex(contents.str());
+                auto it = entries_.find(files[i]);
+                if (it != entries_.end() && it->second.hash == entry.hash)
+                {
+                    entry.application = it->second.application;
+                    continue;
+                }
+
+                try
+                {
+                    goby::clang::InterfaceReader interface(contents);
+                    entry.application = std::make_shared<const Application>(interface);
+                    ++parsed;
+                }
+                catch (const std::exception& e)
+                {
+                    errors[i] = e.what();
+                }
             }
-            catch (const std::exception& e)
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < jobs; ++i) threads.emplace_back(run_worker);
+        run_worker();
+        for (auto& thread : threads) thread.join();
+
+        // report all the failures together, in file order
+        bool failed = false;
+        for (std::size_t i = 0, n = files.size(); i < n; ++i)
+        {
+            if (!errors[i].empty())
             {
-                std::cout << "Failed to parse " << yaml_file << ": " << e.what() << std::endl;
+                std::cerr << "Failed to parse " << files[i] << ": " << errors[i] << std::endl;
+                failed = true;
             }
-
-            applications.emplace(yaml);
         }
+        if (failed)
+            return false;
+
+        entries_.clear();
+        for (std::size_t i = 0, n = files.size(); i < n; ++i)
+            entries_.emplace(files[i], std::move(entries[i]));
+        parsed_ = parsed;
+        return true;
+    }
+
+    std::shared_ptr<const Application> get(const std::string& yaml_file) const
+    {
+        return entries_.at(yaml_file).application;
     }
 
+    // number of files parsed by the last load() (the others were unchanged)
+    std::size_t parsed() const { return parsed_; }
+    std::size_t size() const { return entries_.size(); }
+
+  private:
+    struct Entry
+    {
+        // md5 of the file contents
+        std::string hash;
+        std::shared_ptr<const Application> application;
+    };
+
+    std::map<std::string, Entry> entries_;
+    std::size_t parsed_{0};
+};
+
+struct ApplicationNameLess
+{
+    bool operator()(const std::shared_ptr<const Application>& a,
+                    const std::shared_ptr<const Application>& b) const
+    {
+        return *a < *b;
+    }
+};
+
+struct Platform
+{
+    Platform(const std::string& n, const std::vector<std::string>& yamls,
+             const ApplicationCache& application_cache)
+        : name(n)
+    {
+        // each yaml represents a given application
+        for (const auto& yaml_file : yamls) applications.insert(application_cache.get(yaml_file));
+    }
+    Platform(const std::string& n) : name(n) {}
+
     std::string name;
-    std::set<Application> applications;
+    std::set<std::shared_ptr<const Application>, ApplicationNameLess> applications;
+    // number of identical platforms this one stands for (see collapse())
+    int count{1};
 };
 
 inline bool operator<(const Platform& a, const Platform& b) { return a.name < b.name; }
@@ -198,18 +348,32 @@ inline bool operator<(const Platform& a, const Platform& b) { return a.name < b.
 inline std::ostream& operator<<(std::ostream& os, const Platform& p)
 {
     os << "((" << p.name << "))" << std::endl;
-    for (const auto& a : p.applications) os << "Application: " << a << std::endl;
+    for (const auto& a : p.applications) os << "Application: " << *a << std::endl;
     return os;
 }
 
+// maps platform name to yaml files
+using PlatformYamls = std::map<std::string, std::vector<std::string>>;
+
+inline std::set<std::string> interface_files(const PlatformYamls& platform_yamls)
+{
+    std::set<std::string> yaml_files;
+    for (const auto& platform_yaml_p : platform_yamls)
+        yaml_files.insert(platform_yaml_p.second.begin(), platform_yaml_p.second.end());
+    return yaml_files;
+}
+
 struct Deployment
 {
-    Deployment(const std::string& n,
-               const std::map<std::string, std::vector<std::string>>& platform_yamls)
+    // application_cache must have loaded interface_files(platform_yamls)
+    Deployment(const std::string& n, const PlatformYamls& platform_yamls,
+               const ApplicationCache& application_cache)
         : name(n)
     {
         for (const auto& platform_yaml_p : platform_yamls)
-        { platforms.emplace(platform_yaml_p.first, platform_yaml_p.second); } }
+            platforms.emplace(platform_yaml_p.first, platform_yaml_p.second, application_cache);
+    }
+    Deployment(const std::string& n) : name(n) {}
 
     std::string name;
     std::set<Platform> platforms;
@@ -222,111 +386,729 @@ inline std::ostream& operator<<(std::ostream& os, const Deployment& d)
     return os;
 }
 
+// name with each integer template argument replaced by '#', e.g. "Thread<Config, 3>" becomes
+// "Thread<Config, #>"
+inline std::string collapse_indices(const std::string& name)
+{
+    std::string collapsed;
+    int depth = 0;
+    for (std::size_t i = 0, n = name.size(); i < n;)
+    {
+        char c = name[i++];
+        collapsed += c;
+        if (c == '<')
+            ++depth;
+        else if (c == '>')
+            --depth;
+
+        if (depth == 0 || (c != '<' && c != ','))
+            continue;
+
+        // start of a template argument: [spaces][-]digits[integer suffix][spaces] then ',' or '>'
+        auto skip = [&](std::size_t j, bool (*f)(char)) {
+            while (j < n && f(name[j])) ++j;
+            return j;
+        };
+        auto begin = skip(i, [](char d) { return d == ' '; });
+        auto digits = begin < n && name[begin] == '-' ? begin + 1 : begin;
+        auto end = skip(digits, [](char d) { return d >= '0' && d <= '9'; });
+        if (end == digits)
+            continue;
+        end = skip(end, [](char d) { return d == 'u' || d == 'U' || d == 'l' || d == 'L'; });
+        auto next = skip(end, [](char d) { return d == ' '; });
+        if (next < n && (name[next] == ',' || name[next] == '>'))
+        {
+            collapsed.append(name, i, begin - i);
+            collapsed += '#';
+            i = end;
+        }
+    }
+    return collapsed;
+}
+
+// application with the threads whose names differ only by integer template arguments merged
+// into one thread (counting the threads merged)
+inline std::shared_ptr<const Application> collapse_threads(const Application& application)
+{
+    std::unordered_map<goby::clang::Symbol, goby::clang::Symbol> collapsed_names;
+    auto collapsed_name = [&](goby::clang::Symbol name) {
+        auto it = collapsed_names.find(name);
+        if (it == collapsed_names.end())
+            it = collapsed_names.emplace(name, collapse_indices(name.str())).first;
+        return it->second;
+    };
+    auto insert_collapsed = [&](const std::set<PubSubEntry>& entries,
+                                std::set<PubSubEntry>& collapsed_entries) {
+        for (auto e : entries)
+        {
+            e.thread = collapsed_name(e.thread);
+            goby::clang::insert_merged(collapsed_entries, e);
+        }
+    };
+
+    auto collapsed = std::make_shared<Application>();
+    collapsed->name = application.name;
+    collapsed->types = application.types;
+    for (const auto& thread_p : application.threads)
+    {
+        const auto& thread = *thread_p.second;
+        auto name = collapsed_name(thread.name).str();
+        auto it = collapsed->threads.find(name);
+        if (it == collapsed->threads.end())
+        {
+            std::set<std::string> bases;
+            for (const auto& base : thread.bases) bases.insert(collapsed_name(base).str());
+            auto collapsed_thread = std::make_shared<Thread>(name, bases);
+            collapsed_thread->most_derived_name = collapsed_name(thread.most_derived_name);
+            collapsed_thread->count = 0;
+            it = collapsed->threads.emplace(name, collapsed_thread).first;
+        }
+
+        auto& collapsed_thread = *it->second;
+        collapsed_thread.count += thread.count;
+        insert_collapsed(thread.interthread_publishes, collapsed_thread.interthread_publishes);
+        insert_collapsed(thread.interthread_subscribes, collapsed_thread.interthread_subscribes);
+    }
+
+    for (const auto& most_derived_p : application.most_derived_threads)
+        collapsed->most_derived_threads.emplace(collapsed_name(most_derived_p.first),
+                                                collapsed_name(most_derived_p.second));
+
+    insert_collapsed(application.interprocess_publishes, collapsed->interprocess_publishes);
+    insert_collapsed(application.interprocess_subscribes, collapsed->interprocess_subscribes);
+    insert_collapsed(application.intervehicle_publishes, collapsed->intervehicle_publishes);
+    insert_collapsed(application.intervehicle_subscribes, collapsed->intervehicle_subscribes);
+    return collapsed;
+}
+
+// maps each application to its collapse_threads()
+using CollapsedApplications =
+    std::map<std::shared_ptr<const Application>, std::shared_ptr<const Application>>;
+
+// deployment with one platform (the first by name) for each set of platforms running the same
+// applications, and the threads of each application collapsed by collapse_threads() (unless
+// already in collapsed_applications)
+inline Deployment collapse(const Deployment& deployment,
+                           CollapsedApplications& collapsed_applications)
+{
+    // platforms that list the same interface files share the same Application objects
+    std::map<std::vector<const Application*>, Platform> representatives;
+    for (const auto& platform : deployment.platforms)
+    {
+        std::vector<const Application*> key;
+        for (const auto& application : platform.applications) key.push_back(application.get());
+
+        auto it = representatives.find(key);
+        if (it != representatives.end())
+        {
+            it->second.count += platform.count;
+            continue;
+        }
+
+        Platform representative(platform.name);
+        representative.count = platform.count;
+        for (const auto& application : platform.applications)
+        {
+            auto& collapsed = collapsed_applications[application];
+            if (!collapsed)
+                collapsed = collapse_threads(*application);
+            representative.applications.insert(collapsed);
+        }
+        representatives.emplace(key, representative);
+    }
+
+    Deployment collapsed(deployment.name);
+    for (const auto& representative_p : representatives)
+        collapsed.platforms.insert(representative_p.second);
+    return collapsed;
+}
+
 } // namespace viz
 
 const auto vehicle_color = "darkgreen";
 const auto process_color = "dodgerblue4";
 const auto thread_color = "purple4";
 
-std::string node_name(std::string p, std::string a, std::string th)
+// Buffered writer for the DOT output: everything is appended to a large buffer that is written
+// out in blocks, and node IDs are escaped once per name and then copied from a cache
+class DotWriter
 {
-    std::vector<char> reserved{{':', '&', '<', '>', ' ', ','}};
+  public:
+    DotWriter(std::ostream& os) : os_(os) { buffer_.reserve(buffer_size); }
+    ~DotWriter() { flush(); }
+
+    DotWriter& operator<<(const std::string& str) { return write(str.data(), str.size()); }
+    DotWriter& operator<<(const char* str) { return write(str, std::strlen(str)); }
+    DotWriter& operator<<(char c) { return write(&c, 1); }
+    DotWriter& operator<<(int i)
+    {
+        char str[16];
+        return write(str, std::snprintf(str, sizeof(str), "%d", i));
+    }
+
+    // the ID of the node for thread th of application a on platform p
+    DotWriter& node(const std::string& p, const std::string& a, const std::string& th)
+    {
+        return *this << escaped(p) << '_' << escaped(a) << '_' << escaped(th);
+    }
+
+    void flush()
+    {
+        os_.write(buffer_.data(), buffer_.size());
+        buffer_.clear();
+    }
 
-    for (char r : reserved)
+  private:
+    DotWriter& write(const char* str, std::size_t n)
     {
-        std::string search(1, r);
-        auto replacement = "_" + std::to_string(static_cast<int>(r)) + "_";
-        boost::replace_all(p, search, replacement);
-        boost::replace_all(a, search, replacement);
-        boost::replace_all(th, search, replacement);
+        if (buffer_.size() + n > buffer_size)
+            flush();
+        buffer_.append(str, n);
+        return *this;
     }
 
-    return p + "_" + a + "_" + th;
+    // replace the characters that aren't allowed in node IDs with _{ascii code}_
+    const std::string& escaped(const std::string& name)
+    {
+        auto it = escaped_.find(name);
+        if (it != escaped_.end())
+            return it->second;
+
+        std::string escaped_name;
+        for (char c : name)
+        {
+            switch (c)
+            {
+                case ':':
+                case '&':
+                case '<':
+                case '>':
+                case ' ':
+                case '#':
+                case ',': escaped_name += "_" + std::to_string(static_cast<int>(c)) + "_"; break;
+                default: escaped_name += c; break;
+            }
+        }
+        return escaped_.emplace(name, std::move(escaped_name)).first->second;
+    }
+
+    static constexpr std::size_t buffer_size = 1 << 20;
+    std::ostream& os_;
+    std::string buffer_;
+    std::unordered_map<std::string, std::string> escaped_;
+};
+
+// Estimated messages per second: at least hz if lower_bound (a publication in a loop, or one with
+// contributions of unknown rate)
+struct Rate
+{
+    double hz{0};
+    bool lower_bound{false};
+
+    Rate& operator+=(const Rate& other)
+    {
+        hz += other.hz;
+        lower_bound = lower_bound || other.lower_bound;
+        return *this;
+    }
+};
+
+const Rate unknown_rate{0, true};
+
+std::string format_number(double value)
+{
+    char str[32];
+    std::snprintf(str, sizeof(str), "%.3g", value);
+    return str;
+}
+
+// tooltip text for the layout of type if it has any of the problems of TypeLayout (empty
+// otherwise), escaped for a DOT string
+std::string layout_tooltip(const std::string& type, const goby::clang::TypeLayout& layout)
+{
+    auto score = layout.score();
+    if (score >= 100)
+        return std::string();
+
+    std::string tooltip = type + ": layout score " + std::to_string(score) + "/100\\n" +
+                          std::to_string(layout.padding) + " of " + std::to_string(layout.size) +
+                          " bytes are padding";
+    auto add_members = [&](const char* description, const std::vector<std::string>& members) {
+        if (members.empty())
+            return;
+        tooltip += std::string("\\n") + description + ": ";
+        for (auto it = members.begin(); it != members.end(); ++it)
+            tooltip += (it == members.begin() ? "" : ", ") + *it;
+    };
+    add_members("straddling a cache line", layout.straddling);
+    add_members("atomics sharing a cache line", layout.shared_atomics);
+    add_members("not trivially copyable", layout.non_trivially_copyable);
+
+    boost::algorithm::replace_all(tooltip, "\"", "\\\"");
+    return tooltip;
+}
+
+// [label=...] for an edge carrying pub (standing for count connections, each of rate), with a
+// tooltip for the problems of the layout of its type if given
+void write_label(DotWriter& dot, const PubSubEntry& pub, const char* color, int count = 1,
+                 Rate rate = unknown_rate, const goby::clang::TypeLayout* layout = nullptr)
+{
+    dot << "[label=<<b><font point-size=\"10\">" << pub.group.str()
+        << "</font></b><br/><font point-size=\"6\">" << pub.scheme.str()
+        << "</font><br/><font point-size=\"8\">" << pub.type.str() << "</font>";
+    if (count > 1)
+        dot << "<br/><font point-size=\"8\">&#215;" << count << "</font>";
+    double hz = rate.hz * count;
+    if (hz > 0)
+        dot << "<br/><font point-size=\"8\">" << (rate.lower_bound ? "&#8805;" : "")
+            << format_number(hz) << " msg/s</font>";
+    dot << ">"
+        << "color=" << color;
+    // wider for higher rates
+    if (hz > 0)
+        dot << ",penwidth=" << format_number(1 + std::log10(1 + hz));
+    auto tooltip = layout ? layout_tooltip(pub.type.str(), *layout) : std::string();
+    if (!tooltip.empty())
+        dot << ",tooltip=\"" << tooltip << "\"";
+    dot << "]\n";
 }
 
-std::string connection_with_label_final(const PubSubEntry& pub, std::string pub_str,
-                                        std::string sub_str, std::string color)
+void write_connection(DotWriter& dot, const std::string& pub_platform,
+                      const std::string& pub_application, const PubSubEntry& pub,
+                      const std::string& sub_platform, const std::string& sub_application,
+                      const PubSubEntry& sub, const char* color, int count = 1,
+                      Rate rate = unknown_rate, const goby::clang::TypeLayout* layout = nullptr)
 {
-    return pub_str + "->" + sub_str + "[label=<<b><font point-size=\"10\">" + pub.group +
-           "</font></b><br/><font point-size=\"6\">" + pub.scheme +
-           "</font><br/><font point-size=\"8\">" + pub.type + "</font>>" + "color=" + color + "]\n";
+    dot.node(pub_platform, pub_application, pub.thread.str()) << "->";
+    dot.node(sub_platform, sub_application, sub.thread.str());
+    write_label(dot, pub, color, count, rate, layout);
 }
 
-std::string connection_with_label(std::string pub_platform, std::string pub_application,
-                                  const PubSubEntry& pub, std::string sub_platform,
-                                  std::string sub_application, const PubSubEntry& sub,
-                                  std::string color)
+// number of threads the node of e stands for (more than one if collapsed)
+int thread_count(const viz::Application& application, const PubSubEntry& e)
 {
-    return connection_with_label_final(pub, node_name(pub_platform, pub_application, pub.thread),
-                                       node_name(sub_platform, sub_application, sub.thread), color);
+    auto it = application.threads.find(e.thread.str());
+    return it == application.threads.end() ? 1 : it->second->count;
 }
 
-std::string disconnected_publication(std::string pub_platform, std::string pub_application,
-                                     const PubSubEntry& pub, std::string color)
+void write_disconnected_publication(DotWriter& dot, const std::string& pub_platform,
+                                    const std::string& pub_application, const PubSubEntry& pub,
+                                    const char* color)
 {
-    if(g_omit_disconnected)
-        return "";
-    
+    if (g_omit_disconnected)
+        return;
+
     // hide inner publications without subscribers.
     if (pub.is_inner_pub)
-        return "";
-    else
-        return node_name(pub_platform, pub_application, pub.thread) + "_no_subscribers_" + color +
-               " [label=\"\",style=invis] \n" +
-               connection_with_label_final(pub,
-                                           node_name(pub_platform, pub_application, pub.thread),
-                                           node_name(pub_platform, pub_application, pub.thread) +
-                                               "_no_subscribers_" + color,
-                                           color);
+        return;
+
+    dot.node(pub_platform, pub_application, pub.thread.str())
+        << "_no_subscribers_" << color << " [label=\"\",style=invis] \n";
+    dot.node(pub_platform, pub_application, pub.thread.str()) << "->";
+    dot.node(pub_platform, pub_application, pub.thread.str()) << "_no_subscribers_" << color;
+    write_label(dot, pub, color);
 }
 
-std::string disconnected_subscription(std::string sub_platform, std::string sub_application,
-                                      const PubSubEntry& sub, std::string color)
+void write_disconnected_subscription(DotWriter& dot, const std::string& sub_platform,
+                                     const std::string& sub_application, const PubSubEntry& sub,
+                                     const char* color)
 {
-    if(g_omit_disconnected)
-        return "";
-
-    return node_name(sub_platform, sub_application, sub.thread) + "_no_publishers_" + color +
-           " [label=\"\",style=invis] \n" +
-           connection_with_label_final(sub,
-                                       node_name(sub_platform, sub_application, sub.thread) +
-                                           "_no_publishers_" + color,
-                                       node_name(sub_platform, sub_application, sub.thread), color);
+    if (g_omit_disconnected)
+        return;
+
+    dot.node(sub_platform, sub_application, sub.thread.str())
+        << "_no_publishers_" << color << " [label=\"\",style=invis] \n";
+    dot.node(sub_platform, sub_application, sub.thread.str())
+        << "_no_publishers_" << color << "->";
+    dot.node(sub_platform, sub_application, sub.thread.str());
+    write_label(dot, sub, color);
 }
 
-void write_thread_connections(std::ofstream& ofs, const viz::Platform& platform,
-                              const viz::Application& application, const viz::Thread& thread,
-                              std::set<PubSubEntry>& disconnected_subs)
+// Subscriptions (or publications) within one scope (the threads of an application, the processes
+// of a platform or the whole deployment) hashed on the fields compared by connects(), so that the
+// subscribers of a publication (or the publishers of a subscription) are found by lookup rather
+// than by scanning the scope
+class PubSubIndex
 {
-    std::set<PubSubEntry> disconnected_pubs;
-    for (const auto& pub : thread.interthread_publishes)
+  public:
+    struct Indexed
     {
-        disconnected_pubs.insert(pub);
+        // position in the order added, which is the order of the nested loops over the scope
+        std::size_t order;
+        const viz::Platform* platform;
+        const viz::Application* application;
+        const PubSubEntry* entry;
+    };
+
+    void add(const viz::Platform& platform, const viz::Application& application,
+             const PubSubEntry& entry)
+    {
+        Indexed indexed{next_order_++, &platform, &application, &entry};
+        auto& bucket = buckets_[key(entry)];
+        bucket.all.push_back(indexed);
+        bucket.by_scheme[entry.scheme].push_back(indexed);
+    }
+
+    // call f for each entry for which connects(pub, entry) is true, in the order added
+    template <typename F> void for_each_connected(const PubSubEntry& pub, F f) const
+    {
+        auto it = buckets_.find(key(pub));
+        if (it == buckets_.end())
+            return;
+        const auto& bucket = it->second;
+
+        // CXX_OBJECT on either side matches any scheme
+        if (pub.scheme == cxx_object_scheme)
+        {
+            for (const auto& subscriber : bucket.all) f(subscriber);
+            return;
+        }
+
+        static const std::vector<Indexed> none;
+        auto find_scheme = [&](goby::clang::Symbol scheme) -> const std::vector<Indexed>& {
+            auto scheme_it = bucket.by_scheme.find(scheme);
+            return scheme_it == bucket.by_scheme.end() ? none : scheme_it->second;
+        };
+        const auto& same = find_scheme(pub.scheme);
+        const auto& cxx_object = find_scheme(cxx_object_scheme);
 
-        for (const auto& sub_thread_p : application.threads)
+        // merge the two (disjoint) lists to preserve the order
+        auto same_it = same.begin(), cxx_object_it = cxx_object.begin();
+        while (same_it != same.end() || cxx_object_it != cxx_object.end())
         {
-            const auto& sub_thread = sub_thread_p.second;
-            for (const auto& sub : sub_thread->interthread_subscribes)
+            if (cxx_object_it == cxx_object.end() ||
+                (same_it != same.end() && same_it->order < cxx_object_it->order))
+                f(*same_it++);
+            else
+                f(*cxx_object_it++);
+        }
+    }
+
+  private:
+    struct Key
+    {
+        goby::clang::Layer layer;
+        goby::clang::Symbol group;
+        goby::clang::Symbol type;
+
+        bool operator==(const Key& other) const
+        {
+            return layer == other.layer && group == other.group && type == other.type;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key& key) const
+        {
+            std::hash<goby::clang::Symbol> hash;
+            return (hash(key.group) * 31 + hash(key.type)) * 31 + static_cast<int>(key.layer);
+        }
+    };
+
+    static Key key(const PubSubEntry& e) { return {e.layer, e.group, e.type}; }
+
+    struct Bucket
+    {
+        std::vector<Indexed> all;
+        std::unordered_map<goby::clang::Symbol, std::vector<Indexed>> by_scheme;
+    };
+
+    static const goby::clang::Symbol cxx_object_scheme;
+    std::size_t next_order_{0};
+    std::unordered_map<Key, Bucket, KeyHash> buckets_;
+};
+
+const goby::clang::Symbol PubSubIndex::cxx_object_scheme("CXX_OBJECT");
+
+// Estimated rates of the publications in a deployment, evaluated from the rate expressions
+// written by -gen for each call site (see PubSubEntry::rates): a number of Hz, "once",
+// "rate(group)" for a subscribe callback (the total rate of the publications the thread receives
+// on group) or "?", prefixed with "N*" for each loop around the call. All are computed up front,
+// so lookups are thread safe.
+class RateModel
+{
+  public:
+    // publications on the groups in group_rates have the given rate (Hz) instead (see -rates)
+    using GroupRates = std::map<goby::clang::Symbol, double>;
+
+    RateModel(const viz::Deployment& deployment, GroupRates group_rates = GroupRates())
+        : group_rates_(std::move(group_rates))
+    {
+        // the publications of each scope, to find the publishers of a subscription (the
+        // interthread publications of the threads of an application merged, since a base thread
+        // publishes as its most derived thread)
+        for (const auto& platform : deployment.platforms)
+        {
+            for (const auto& application : platform.applications)
             {
-                if (goby::clang::connects(pub, sub))
+                auto& thread_publications = thread_publications_[application.get()];
+                if (thread_publications.empty())
                 {
-                    remove_disconnected(pub, sub, disconnected_pubs, disconnected_subs);
-                    ofs << "\t\t\t"
-                        << connection_with_label(platform.name, application.name, pub,
-                                                 platform.name, application.name, sub, thread_color)
-                        << "\n";
+                    for (const auto& thread_p : application->threads)
+                    {
+                        for (const auto& pub : thread_p.second->interthread_publishes)
+                            goby::clang::insert_merged(thread_publications, pub);
+                    }
                 }
+
+                auto& thread_publishers = thread_publishers_[{&platform, application.get()}];
+                for (const auto& pub : thread_publications)
+                    thread_publishers.add(platform, *application, pub);
+                for (const auto& pub : application->interprocess_publishes)
+                    process_publishers_[&platform].add(platform, *application, pub);
+                for (const auto& pub : application->intervehicle_publishes)
+                    vehicle_publishers_.add(platform, *application, pub);
             }
         }
+
+        for (const auto& platform : deployment.platforms)
+        {
+            for (const auto& application : platform.applications)
+            {
+                for (const auto& pub : thread_publications_.at(application.get()))
+                    rate(platform, *application, pub);
+                for (const auto& pub : application->interprocess_publishes)
+                    rate(platform, *application, pub);
+                for (const auto& pub : application->intervehicle_publishes)
+                    rate(platform, *application, pub);
+
+                // for the subscriptions that copy each message (see -copy-report)
+                for (const auto& thread_p : application->threads)
+                {
+                    for (const auto& sub : thread_p.second->interthread_subscribes)
+                    {
+                        if (!sub.copies.empty())
+                            received_rates_[{&platform, application.get(), sub.thread,
+                                             sub.group}] =
+                                received(platform, *application, sub.thread, sub.group);
+                    }
+                }
+            }
+        }
+
+        thread_publishers_.clear();
+        process_publishers_.clear();
+        vehicle_publishers_ = PubSubIndex();
+    }
+
+    // estimated rate of pub, published by application on platform
+    Rate get(const viz::Platform& platform, const viz::Application& application,
+             const PubSubEntry& pub) const
+    {
+        auto it = rates_.find({&platform, canonical(application, pub)});
+        return it == rates_.end() ? unknown_rate : it->second;
+    }
+
+    // estimated rate of the publish() call at site (one of the keys of pub.rates)
+    Rate get(const viz::Platform& platform, const viz::Application& application,
+             const PubSubEntry& pub, const std::string& site) const
+    {
+        auto it = site_rates_.find({{&platform, canonical(application, pub)}, site});
+        return it == site_rates_.end() ? unknown_rate : it->second;
+    }
+
+    // estimated rate of the messages received by sub, an interthread subscription that copies
+    // them
+    Rate received_rate(const viz::Platform& platform, const viz::Application& application,
+                       const PubSubEntry& sub) const
+    {
+        auto it = received_rates_.find({&platform, &application, sub.thread, sub.group});
+        return it == received_rates_.end() ? unknown_rate : it->second;
+    }
+
+    // the rates of the interthread publications of application on platform, as text
+    std::string signature(const viz::Platform& platform, const viz::Application& application) const
+    {
+        std::string signature;
+        for (const auto& pub : thread_publications_.at(&application))
+        {
+            auto rate = get(platform, application, pub);
+            char str[48];
+            std::snprintf(str, sizeof(str), "%a%c", rate.hz, rate.lower_bound ? '+' : ';');
+            signature += str;
+        }
+        return signature;
+    }
+
+  private:
+    // the entry holding the merged rates of pub
+    const PubSubEntry* canonical(const viz::Application& application, const PubSubEntry& pub) const
+    {
+        if (pub.layer != goby::clang::Layer::INTERTHREAD)
+            return &pub;
+        const auto& thread_publications = thread_publications_.at(&application);
+        auto it = thread_publications.find(pub);
+        return it == thread_publications.end() ? &pub : &*it;
+    }
+
+    Rate rate(const viz::Platform& platform, const viz::Application& application,
+              const PubSubEntry& pub)
+    {
+        Key key{&platform, canonical(application, pub)};
+        auto it = rates_.find(key);
+        if (it != rates_.end())
+            return it->second;
+
+        // a cycle of callbacks back to this publication contributes an unknown rate
+        rates_[key] = unknown_rate;
+
+        Rate total;
+        auto group_rate = group_rates_.find(pub.group);
+        if (group_rate != group_rates_.end())
+        {
+            // split evenly between the call sites
+            total = Rate{group_rate->second, false};
+            for (const auto& rate_p : pub.rates)
+                site_rates_[{key, rate_p.first}] = Rate{total.hz / pub.rates.size(), false};
+        }
+        else
+        {
+            if (pub.rates.empty())
+                total = unknown_rate;
+            for (const auto& rate_p : pub.rates)
+            {
+                auto site_rate = evaluate(platform, application, pub.thread, rate_p.second);
+                site_rates_[{key, rate_p.first}] = site_rate;
+                total += site_rate;
+            }
+        }
+        rates_[key] = total;
+        return total;
+    }
+
+    Rate evaluate(const viz::Platform& platform, const viz::Application& application,
+                  goby::clang::Symbol thread, std::string expression)
+    {
+        bool in_loop = false;
+        while (expression.compare(0, 2, "N*") == 0)
+        {
+            in_loop = true;
+            expression.erase(0, 2);
+        }
+
+        Rate rate = unknown_rate;
+        const std::string received_prefix = "rate(";
+        if (expression == "once")
+        {
+            rate = Rate();
+        }
+        else if (expression.compare(0, received_prefix.size(), received_prefix) == 0 &&
+                 expression.back() == ')')
+        {
+            rate = received(platform, application, thread,
+                            expression.substr(received_prefix.size(),
+                                              expression.size() - received_prefix.size() - 1));
+        }
+        else if (!expression.empty())
+        {
+            char* end;
+            double hz = std::strtod(expression.c_str(), &end);
+            if (*end == '\0')
+                rate = Rate{hz, false};
+        }
+
+        if (in_loop)
+            rate.lower_bound = true;
+        return rate;
+    }
+
+    // total rate of the publications received by the subscriptions of thread to group (by each of
+    // the threads it stands for, if collapsed)
+    Rate received(const viz::Platform& platform, const viz::Application& application,
+                  goby::clang::Symbol thread, goby::clang::Symbol group)
+    {
+        Rate total;
+        // every publisher a collapsed node stands for sends to the subscriber (and, intervehicle,
+        // one on every platform a collapsed platform stands for), as counted by the edges
+        auto add_publishers = [&](const PubSubIndex& publishers, const PubSubEntry& sub,
+                                  bool count_platforms = false) {
+            publishers.for_each_connected(sub, [&](const PubSubIndex::Indexed& p) {
+                Rate pub_rate = rate(*p.platform, *p.application, *p.entry);
+                int count = thread_count(*p.application, *p.entry);
+                if (count_platforms)
+                    count *= p.platform->count;
+                pub_rate.hz *= count;
+                total += pub_rate;
+            });
+        };
+
+        std::set<PubSubEntry> thread_subs;
+        for (const auto& thread_p : application.threads)
+        {
+            for (const auto& sub : thread_p.second->interthread_subscribes)
+            {
+                if (sub.thread == thread && sub.group == group)
+                    thread_subs.insert(sub);
+            }
+        }
+        for (const auto& sub : thread_subs)
+            add_publishers(thread_publishers_.at({&platform, &application}), sub);
+
+        for (const auto& sub : application.interprocess_subscribes)
+        {
+            if (sub.thread == thread && sub.group == group)
+                add_publishers(process_publishers_[&platform], sub);
+        }
+        for (const auto& sub : application.intervehicle_subscribes)
+        {
+            if (sub.thread == thread && sub.group == group)
+                add_publishers(vehicle_publishers_, sub, true);
+        }
+        return total;
+    }
+
+    GroupRates group_rates_;
+
+    using Key = std::pair<const viz::Platform*, const PubSubEntry*>;
+    std::map<Key, Rate> rates_;
+    std::map<std::pair<Key, std::string>, Rate> site_rates_;
+    std::map<std::tuple<const viz::Platform*, const viz::Application*, goby::clang::Symbol,
+                        goby::clang::Symbol>,
+             Rate>
+        received_rates_;
+    std::map<const viz::Application*, std::set<PubSubEntry>> thread_publications_;
+
+    // only used while computing the rates
+    std::map<std::pair<const viz::Platform*, const viz::Application*>, PubSubIndex>
+        thread_publishers_;
+    std::map<const viz::Platform*, PubSubIndex> process_publishers_;
+    PubSubIndex vehicle_publishers_;
+};
+
+void write_thread_connections(DotWriter& dot, const viz::Platform& platform,
+                              const viz::Application& application, const viz::Thread& thread,
+                              const PubSubIndex& thread_subscribers, const RateModel& rates,
+                              std::set<PubSubEntry>& disconnected_subs)
+{
+    std::set<PubSubEntry> disconnected_pubs;
+    for (const auto& pub : thread.interthread_publishes)
+    {
+        disconnected_pubs.insert(pub);
+
+        thread_subscribers.for_each_connected(pub, [&](const PubSubIndex::Indexed& s) {
+            remove_disconnected(pub, *s.entry, disconnected_pubs, disconnected_subs);
+            dot << "\t\t\t";
+            write_connection(dot, platform.name, application.name, pub, platform.name,
+                             application.name, *s.entry, thread_color,
+                             thread_count(application, pub) * thread_count(application, *s.entry),
+                             rates.get(platform, application, pub),
+                             application.type_layout(pub));
+            dot << "\n";
+        });
     }
 
     for (const auto& pub : disconnected_pubs)
-        ofs << "\t\t\t"
-            << disconnected_publication(platform.name, application.name, pub, thread_color) << "\n";
+    {
+        dot << "\t\t\t";
+        write_disconnected_publication(dot, platform.name, application.name, pub, thread_color);
+        dot << "\n";
+    }
 }
 
-void write_process_connections(std::ofstream& ofs, const viz::Platform& platform,
+void write_process_connections(DotWriter& dot, const viz::Platform& platform,
                                const viz::Application& pub_application,
+                               const PubSubIndex& process_subscribers, const RateModel& rates,
                                std::map<std::string, std::set<PubSubEntry>>& disconnected_subs)
 {
     std::set<PubSubEntry> disconnected_pubs;
@@ -334,79 +1116,316 @@ void write_process_connections(std::ofstream& ofs, const viz::Platform& platform
     for (const auto& pub : pub_application.interprocess_publishes)
     {
         disconnected_pubs.insert(pub);
-        for (const auto& sub_application : platform.applications)
-        {
-            for (const auto& sub : sub_application.interprocess_subscribes)
-            {
-                if (goby::clang::connects(pub, sub))
-                {
-                    remove_disconnected(pub, sub, disconnected_pubs,
-                                        disconnected_subs[sub_application.name]);
-
-                    ofs << "\t\t"
-                        << connection_with_label(platform.name, pub_application.name, pub,
-                                                 platform.name, sub_application.name, sub,
-                                                 process_color)
-                        << "\n";
-                }
-            }
-        }
+        process_subscribers.for_each_connected(pub, [&](const PubSubIndex::Indexed& s) {
+            remove_disconnected(pub, *s.entry, disconnected_pubs,
+                                disconnected_subs[s.application->name]);
+
+            dot << "\t\t";
+            write_connection(dot, platform.name, pub_application.name, pub, platform.name,
+                             s.application->name, *s.entry, process_color,
+                             thread_count(pub_application, pub) *
+                                 thread_count(*s.application, *s.entry),
+                             rates.get(platform, pub_application, pub),
+                             pub_application.type_layout(pub));
+            dot << "\n";
+        });
     }
 
     for (const auto& pub : disconnected_pubs)
-        ofs << "\t\t\t"
-            << disconnected_publication(platform.name, pub_application.name, pub, process_color)
-            << "\n";
+    {
+        dot << "\t\t\t";
+        write_disconnected_publication(dot, platform.name, pub_application.name, pub,
+                                       process_color);
+        dot << "\n";
+    }
 }
 
 void write_vehicle_connections(
-    std::ofstream& ofs, const viz::Deployment& deployment, const viz::Platform& pub_platform,
-    const viz::Application& pub_application,
+    DotWriter& dot, const viz::Platform& pub_platform,
+    const viz::Application& pub_application, const PubSubIndex& vehicle_subscribers,
+    const RateModel& rates,
     std::map<std::string, std::map<std::string, std::set<PubSubEntry>>>& disconnected_subs)
 {
     std::set<PubSubEntry> disconnected_pubs;
     for (const auto& pub : pub_application.intervehicle_publishes)
     {
         disconnected_pubs.insert(pub);
-        for (const auto& sub_platform : deployment.platforms)
+        vehicle_subscribers.for_each_connected(pub, [&](const PubSubIndex::Indexed& s) {
+            remove_disconnected(pub, *s.entry, disconnected_pubs,
+                                disconnected_subs[s.platform->name][s.application->name]);
+
+            dot << "\t\t";
+            write_connection(dot, pub_platform.name, pub_application.name, pub, s.platform->name,
+                             s.application->name, *s.entry, vehicle_color,
+                             pub_platform.count * thread_count(pub_application, pub) *
+                                 s.platform->count * thread_count(*s.application, *s.entry),
+                             rates.get(pub_platform, pub_application, pub),
+                             pub_application.type_layout(pub));
+            dot << "\n";
+        });
+    }
+
+    for (const auto& pub : disconnected_pubs)
+    {
+        dot << "\t\t\t";
+        write_disconnected_publication(dot, pub_platform.name, pub_application.name, pub,
+                                       vehicle_color);
+        dot << "\n";
+    }
+}
+
+// HTML label for a thread node
+std::string thread_display_name(const viz::Thread& thread)
+{
+    std::string display_name = thread.most_derived_name.str();
+    using boost::algorithm::replace_all;
+    replace_all(display_name, "&", "&amp;");
+    replace_all(display_name, "\"", "&quot;");
+    replace_all(display_name, "\'", "&apos;");
+    replace_all(display_name, "<", "&lt;");
+    replace_all(display_name, ">", "&gt;");
+
+    boost::algorithm::replace_first(display_name, "&lt;", "<br/>&lt;");
+    replace_all(display_name, "&lt;", "<font point-size=\"10\">&lt;");
+    replace_all(display_name, "&gt;", "&gt;</font>");
+
+    replace_all(display_name, ", ", ",<br/>");
+    return display_name;
+}
+
+void write_thread_node(DotWriter& dot, const viz::Platform& platform,
+                       const viz::Application& application, const viz::Thread& thread)
+{
+    dot.node(platform.name, application.name, thread.most_derived_name.str())
+        << " [label=<" << thread_display_name(thread);
+    if (thread.count > 1)
+        dot << "<br/>&#215;" << thread.count;
+    dot << ">,fontcolor=" << thread_color << ",shape=box]\n";
+}
+
+void write_platform_label(DotWriter& dot, const viz::Platform& platform)
+{
+    dot << "\tlabel=\"" << platform.name;
+    if (platform.count > 1)
+        dot << " (" << platform.count << " platforms)";
+    dot << "\"\n";
+}
+
+// the cluster (numbered cluster) of application on platform with its threads and their
+// interthread connections
+void write_application(DotWriter& dot, const viz::Platform& platform,
+                       const viz::Application& application, const RateModel& rates, int cluster)
+{
+    dot << "\t\tsubgraph cluster_" << cluster << " {\n";
+    dot << "\t\tlabel=\"" << application.name << "\"\n";
+    dot << "\t\tfontcolor=\"" << process_color << "\"\n";
+
+    std::set<PubSubEntry> thread_disconnected_subs;
+    PubSubIndex thread_subscribers;
+    for (const auto& thread_p : application.threads)
+    {
+        const auto& thread = thread_p.second;
+
+        for (const auto& sub : thread->interthread_subscribes)
         {
-            for (const auto& sub_application : sub_platform.applications)
+            thread_disconnected_subs.insert(sub);
+            thread_subscribers.add(platform, application, sub);
+        }
+    }
+
+    for (const auto& thread_p : application.threads)
+    {
+        const auto& thread = thread_p.second;
+
+        dot << "\t\t\t";
+        write_thread_node(dot, platform, application, *thread);
+
+        write_thread_connections(dot, platform, application, *thread, thread_subscribers, rates,
+                                 thread_disconnected_subs);
+    }
+
+    for (const auto& sub : thread_disconnected_subs)
+    {
+        dot << "\t\t\t";
+        write_disconnected_subscription(dot, platform.name, application.name, sub, thread_color);
+        dot << "\n";
+    }
+
+    dot << "\t\t}\n";
+}
+
+// The text written by write_application() for each application cluster, kept between the renders
+// of -watch so that only the clusters of reloaded applications (new Application objects) or with
+// changed interthread rates are written again
+class FragmentCache
+{
+  public:
+    const std::string& get(const viz::Platform& platform,
+                           const std::shared_ptr<const viz::Application>& application,
+                           const RateModel& rates, int cluster)
+    {
+        Key key{platform.name, application.get(), cluster, rates.signature(platform, *application)};
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = fragments_.find(key);
+            if (it != fragments_.end())
             {
-                for (const auto& sub : sub_application.intervehicle_subscribes)
-                {
-                    if (goby::clang::connects(pub, sub))
-                    {
-                        remove_disconnected(
-                            pub, sub, disconnected_pubs,
-                            disconnected_subs[sub_platform.name][sub_application.name]);
-
-                        ofs << "\t\t"
-                            << connection_with_label(pub_platform.name, pub_application.name, pub,
-                                                     sub_platform.name, sub_application.name, sub,
-                                                     vehicle_color)
-                            << "\n";
-                    }
-                }
+                it->second.used = true;
+                ++reused_;
+                return it->second.text;
             }
         }
+
+        std::ostringstream text;
+        {
+            DotWriter dot(text);
+            write_application(dot, platform, *application, rates, cluster);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        // the Application is held so that its address isn't reused while it is part of a key
+        return fragments_.emplace(key, Fragment{application, text.str(), true})
+            .first->second.text;
     }
 
-    for (const auto& pub : disconnected_pubs)
-        ofs << "\t\t\t"
-            << disconnected_publication(pub_platform.name, pub_application.name, pub, vehicle_color)
-            << "\n";
+    // drop the fragments not used since the last call, returning the number reused
+    std::size_t prune()
+    {
+        for (auto it = fragments_.begin(); it != fragments_.end();)
+        {
+            if (it->second.used)
+                (it++)->second.used = false;
+            else
+                it = fragments_.erase(it);
+        }
+        auto reused = reused_;
+        reused_ = 0;
+        return reused;
+    }
+
+  private:
+    struct Key
+    {
+        std::string platform;
+        const viz::Application* application;
+        int cluster;
+        std::string rates;
+
+        bool operator<(const Key& other) const
+        {
+            return std::tie(platform, application, cluster, rates) <
+                   std::tie(other.platform, other.application, other.cluster, other.rates);
+        }
+    };
+
+    struct Fragment
+    {
+        std::shared_ptr<const viz::Application> application;
+        std::string text;
+        bool used;
+    };
+
+    std::mutex mutex_;
+    std::map<Key, Fragment> fragments_;
+    std::size_t reused_{0};
+};
+
+// the cluster for platform (numbered from cluster) with its applications, their threads and all
+// the interthread and interprocess connections (application clusters from fragments if given)
+void write_platform(DotWriter& dot, const viz::Platform& platform, const RateModel& rates,
+                    int cluster, FragmentCache* fragments = nullptr)
+{
+    dot << "\tsubgraph cluster_" << cluster++ << " {\n";
+    write_platform_label(dot, platform);
+    dot << "\tfontcolor=\"" << vehicle_color << "\"\n";
+
+    std::map<std::string, std::set<PubSubEntry>> process_disconnected_subs;
+    PubSubIndex process_subscribers;
+    for (const auto& application : platform.applications)
+    {
+        for (const auto& sub : application->interprocess_subscribes)
+        {
+            process_disconnected_subs[application->name].insert(sub);
+            process_subscribers.add(platform, *application, sub);
+        }
+    }
+
+    for (const auto& application : platform.applications)
+    {
+        if (fragments)
+            dot << fragments->get(platform, application, rates, cluster++);
+        else
+            write_application(dot, platform, *application, rates, cluster++);
+
+        write_process_connections(dot, platform, *application, process_subscribers, rates,
+                                  process_disconnected_subs);
+    }
+
+    for (const auto& sub_p : process_disconnected_subs)
+    {
+        for (const auto& sub : sub_p.second)
+        {
+            dot << "\t\t\t";
+            write_disconnected_subscription(dot, platform.name, sub_p.first, sub,
+                                            process_color);
+            dot << "\n";
+        }
+    }
+
+    dot << "\t}\n";
 }
 
-int goby::clang::visualize(const std::vector<std::string>& yamls, std::string output_directory,
-                           std::string output_file, std::string deployment_config_input, bool omit_disconnected)
+// the platform cluster with only the threads that publish or subscribe intervehicle, for the
+// summary graph of a sharded output (the same cluster numbers and node IDs as the full graph)
+void write_intervehicle_nodes(DotWriter& dot, const viz::Platform& platform, int cluster)
 {
-    g_omit_disconnected = omit_disconnected;
-    
-    std::string deployment_name;
+    dot << "\tsubgraph cluster_" << cluster++ << " {\n";
+    write_platform_label(dot, platform);
+    dot << "\tfontcolor=\"" << vehicle_color << "\"\n";
+
+    for (const auto& application_p : platform.applications)
+    {
+        const auto& application = *application_p;
+        std::set<goby::clang::Symbol> threads;
+        for (const auto& pub : application.intervehicle_publishes) threads.insert(pub.thread);
+        for (const auto& sub : application.intervehicle_subscribes) threads.insert(sub.thread);
+
+        if (!threads.empty())
+        {
+            dot << "\t\tsubgraph cluster_" << cluster << " {\n";
+            dot << "\t\tlabel=\"" << application.name << "\"\n";
+            dot << "\t\tfontcolor=\"" << process_color << "\"\n";
+            for (const auto& thread : threads)
+            {
+                dot << "\t\t\t";
+                write_thread_node(dot, platform, application,
+                                  *application.threads.at(thread.str()));
+            }
+            dot << "\t\t}\n";
+        }
+        ++cluster;
+    }
+
+    dot << "\t}\n";
+}
 
-    // maps platform name to yaml files
-    std::map<std::string, std::vector<std::string>> platform_yamls;
+// name with anything but alphanumerics, '-', '_' and '.' replaced by '_'
+std::string file_name_safe(std::string name)
+{
+    for (auto& c : name)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_' && c != '.')
+            c = '_';
+    }
+    return name;
+}
 
+// the deployment name and the interface files of each platform: from the deployment file (the
+// first of yamls) or, if deployment_config_input (the name) is given, all of yamls on one platform
+void read_deployment(const std::vector<std::string>& yamls,
+                     const std::string& deployment_config_input, std::string& deployment_name,
+                     viz::PlatformYamls& platform_yamls)
+{
     // assume deployment file
     if (deployment_config_input.empty())
     {
@@ -456,133 +1475,553 @@ int goby::clang::visualize(const std::vector<std::string>& yamls, std::string ou
         // use the yaml files passed as arguments to goby_clang_tool as if they belong to one deployment
         platform_yamls.insert(std::make_pair("default", yamls));
     }
+}
 
-    viz::Deployment deployment(deployment_name, platform_yamls);
-
+// write the graph of deployment to output_file (and each platform to its own file if sharding),
+// taking the application clusters from fragments if given; returns the output file name
+std::string write_graph(const viz::Deployment& deployment, const RateModel& rates,
+                        const std::string& output_directory, std::string output_file,
+                        const goby::clang::VisualizeOptions& options, FragmentCache* fragments)
+{
     if (output_file.empty())
         output_file = deployment.name + ".dot";
 
+    // with -watch the output is replaced in one step so that viewers never read it half written
     std::string file_name(output_directory + "/" + output_file);
-    std::ofstream ofs(file_name.c_str());
+    std::string write_name = options.watch ? file_name + ".tmp" : file_name;
+    std::ofstream ofs(write_name.c_str());
     if (!ofs.is_open())
     {
-        std::cerr << "Failed to open " << file_name << " for writing" << std::endl;
+        std::cerr << "Failed to open " << write_name << " for writing" << std::endl;
         exit(EXIT_FAILURE);
     }
 
+    // cluster numbers are fixed up front so that they are the same in every output file: each
+    // platform is followed by its applications
+    std::map<const viz::Platform*, int> platform_cluster;
     int cluster = 0;
-    ofs << "digraph " << deployment.name << " { \n";
-    ofs << " splines=polyline\n";
-    
+    for (const auto& platform : deployment.platforms)
+    {
+        platform_cluster[&platform] = cluster;
+        cluster += 1 + platform.applications.size();
+    }
+
+    auto write_header = [&](DotWriter& dot) {
+        dot << "digraph " << deployment.name << " { \n";
+        dot << " splines=polyline\n";
+    };
+
+    if (options.shard)
+    {
+        // each platform cluster goes to its own file, written concurrently
+        std::string stem = output_file;
+        if (boost::algorithm::ends_with(stem, ".dot"))
+            stem.resize(stem.size() - 4);
+
+        // platform names that only differ in the characters file_name_safe() replaces (e.g.
+        // "auv 1" and "auv_1") get a numbered suffix (in platform order) rather than one file
+        std::vector<const viz::Platform*> platforms;
+        std::vector<std::string> shard_names;
+        std::set<std::string> used_names;
+        for (const auto& platform : deployment.platforms)
+        {
+            std::string base = output_directory + "/" + stem + "_" + file_name_safe(platform.name);
+            std::string shard_name = base + ".dot";
+            for (int suffix = 2; !used_names.insert(shard_name).second; ++suffix)
+                shard_name = base + "_" + std::to_string(suffix) + ".dot";
+            platforms.push_back(&platform);
+            shard_names.push_back(shard_name);
+        }
+        std::vector<std::string> errors(platforms.size());
+
+        unsigned jobs = options.jobs;
+        if (jobs == 0)
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+        jobs = std::min<std::size_t>(jobs, std::max<std::size_t>(1, platforms.size()));
+
+        std::atomic<std::size_t> next_platform{0};
+        auto run_worker = [&]() {
+            for (auto i = next_platform++; i < platforms.size(); i = next_platform++)
+            {
+                const auto& platform = *platforms[i];
+                const auto& shard_name = shard_names[i];
+                std::ofstream shard_ofs(shard_name.c_str());
+                if (!shard_ofs.is_open())
+                {
+                    errors[i] = "Failed to open " + shard_name + " for writing";
+                    continue;
+                }
+
+                DotWriter shard(shard_ofs);
+                write_header(shard);
+                write_platform(shard, platform, rates, platform_cluster.at(&platform), fragments);
+                shard << "}\n";
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < jobs; ++i) threads.emplace_back(run_worker);
+        run_worker();
+        for (auto& thread : threads) thread.join();
+
+        bool failed = false;
+        for (const auto& error : errors)
+        {
+            if (!error.empty())
+            {
+                std::cerr << error << std::endl;
+                failed = true;
+            }
+        }
+        if (failed)
+            exit(EXIT_FAILURE);
+    }
+
+    DotWriter dot(ofs);
+    write_header(dot);
 
     std::map<std::string, std::map<std::string, std::set<PubSubEntry>>> platform_disconnected_subs;
+    PubSubIndex vehicle_subscribers;
     for (const auto& sub_platform : deployment.platforms)
     {
         for (const auto& sub_application : sub_platform.applications)
         {
-            for (const auto& sub : sub_application.intervehicle_subscribes)
-            { platform_disconnected_subs[sub_platform.name][sub_application.name].insert(sub); } }
+            for (const auto& sub : sub_application->intervehicle_subscribes)
+            {
+                platform_disconnected_subs[sub_platform.name][sub_application->name].insert(sub);
+                vehicle_subscribers.add(sub_platform, *sub_application, sub);
+            }
+        }
     }
 
     for (const auto& platform : deployment.platforms)
     {
-        ofs << "\tsubgraph cluster_" << cluster++ << " {\n";
-        ofs << "\tlabel=\"" << platform.name << "\"\n";
-        ofs << "\tfontcolor=\"" << vehicle_color << "\"\n";
+        if (options.shard)
+            write_intervehicle_nodes(dot, platform, platform_cluster.at(&platform));
+        else
+            write_platform(dot, platform, rates, platform_cluster.at(&platform), fragments);
 
-        std::map<std::string, std::set<PubSubEntry>> process_disconnected_subs;
         for (const auto& application : platform.applications)
+            write_vehicle_connections(dot, platform, *application, vehicle_subscribers, rates,
+                                      platform_disconnected_subs);
+    }
+
+    for (const auto& sub_plat_p : platform_disconnected_subs)
+    {
+        for (const auto& sub_app_p : sub_plat_p.second)
         {
-            for (const auto& sub : application.interprocess_subscribes)
-                process_disconnected_subs[application.name].insert(sub);
+            for (const auto& sub : sub_app_p.second)
+            {
+                dot << "\t\t\t";
+                write_disconnected_subscription(dot, sub_plat_p.first, sub_app_p.first, sub,
+                                                vehicle_color);
+                dot << "\n";
+            }
         }
+    }
+
+    dot << "}\n";
+    dot.flush();
+    ofs.close();
+
+    if (options.watch && std::rename(write_name.c_str(), file_name.c_str()) != 0)
+    {
+        std::cerr << "Failed to rename " << write_name << " to " << file_name << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return file_name;
+
+}
+
+// the publication rates of the -rates file (none if file_name is empty)
+RateModel::GroupRates read_rates(const std::string& file_name)
+{
+    RateModel::GroupRates group_rates;
+    if (file_name.empty())
+        return group_rates;
 
+    try
+    {
+        auto rates_node = YAML::LoadFile(file_name)["rates"];
+        if (!rates_node || !rates_node.IsMap())
+        {
+            std::cerr << "Must specify rates: as a map of group to Hz in rates file " << file_name
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        for (auto rate : rates_node)
+            group_rates[rate.first.as<std::string>()] = rate.second.as<double>();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Failed to parse rates file: " << file_name << ": " << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return group_rates;
+}
+
+// Writes the bytes per second of the intervehicle publications over each link from a publishing
+// platform to a subscribing one (each publication counted once per subscribing platform), the
+// maximum DCCL encoded size times the publication rate; returns the number of links over
+// link_capacity (bits per second, if non-zero)
+int write_bandwidth_report(std::ostream& os, const viz::Deployment& deployment,
+                           const RateModel& rates, goby::clang::DcclSizes& sizes,
+                           double link_capacity)
+{
+    PubSubIndex vehicle_subscribers;
+    for (const auto& platform : deployment.platforms)
+    {
         for (const auto& application : platform.applications)
         {
-            ofs << "\t\tsubgraph cluster_" << cluster++ << " {\n";
-            ofs << "\t\tlabel=\"" << application.name << "\"\n";
-            ofs << "\t\tfontcolor=\"" << process_color << "\"\n";
+            for (const auto& sub : application->intervehicle_subscribes)
+                vehicle_subscribers.add(platform, *application, sub);
+        }
+    }
+
+    struct Link
+    {
+        Rate bytes_per_second;
+        std::vector<std::string> publications;
+    };
+    std::map<std::pair<std::string, std::string>, Link> links;
 
-            std::set<PubSubEntry> thread_disconnected_subs;
-            for (const auto& thread_p : application.threads)
+    static const goby::clang::Symbol dccl_scheme("DCCL");
+    for (const auto& platform : deployment.platforms)
+    {
+        for (const auto& application : platform.applications)
+        {
+            for (const auto& pub : application->intervehicle_publishes)
             {
-                const auto& thread = thread_p.second;
+                std::set<std::string> sub_platforms;
+                vehicle_subscribers.for_each_connected(pub, [&](const PubSubIndex::Indexed& s) {
+                    if (s.platform != &platform)
+                        sub_platforms.insert(s.platform->name);
+                });
+                if (sub_platforms.empty())
+                    continue;
+
+                std::string error = "scheme " + pub.scheme.str() + " is not DCCL";
+                int bytes = pub.scheme == dccl_scheme ? sizes.max_size(pub.type.str(), error) : -1;
+                auto rate = rates.get(platform, *application, pub);
+
+                std::string description = application->name + "/" + pub.thread.str() +
+                                          " publishes " + pub.group.str() + " (" +
+                                          pub.type.str() + "): ";
+                Rate bytes_per_second = unknown_rate;
+                if (bytes < 0)
+                {
+                    description += "size unknown, " + error;
+                }
+                else if (rate.hz == 0 && rate.lower_bound)
+                {
+                    description += std::to_string(bytes) + " bytes at an unknown rate";
+                }
+                else
+                {
+                    bytes_per_second = Rate{bytes * rate.hz, rate.lower_bound};
+                    description += std::to_string(bytes) + " bytes at " +
+                                   (rate.lower_bound ? ">=" : "") + format_number(rate.hz) +
+                                   " msg/s";
+                }
 
-                for (const auto& sub : thread->interthread_subscribes)
-                    thread_disconnected_subs.insert(sub);
+                for (const auto& sub_platform : sub_platforms)
+                {
+                    auto& link = links[{platform.name, sub_platform}];
+                    link.bytes_per_second += bytes_per_second;
+                    link.publications.push_back(description);
+                }
             }
+        }
+    }
+
+    os << "Intervehicle bandwidth of deployment " << deployment.name;
+    if (link_capacity > 0)
+        os << " (link capacity " << format_number(link_capacity) << " bits/s)";
+    os << ":\n";
 
-            for (const auto& thread_p : application.threads)
+    int oversubscribed = 0;
+    for (const auto& link_p : links)
+    {
+        const auto& load = link_p.second.bytes_per_second;
+        double bits_per_second = 8 * load.hz;
+        os << "  " << link_p.first.first << " -> " << link_p.first.second << ": "
+           << (load.lower_bound ? ">=" : "") << format_number(load.hz) << " bytes/s ("
+           << format_number(bits_per_second) << " bits/s";
+        if (link_capacity > 0)
+            os << ", " << format_number(100 * bits_per_second / link_capacity) << "% of capacity";
+        os << ")";
+        if (link_capacity > 0 && bits_per_second > link_capacity)
+        {
+            os << " OVERSUBSCRIBED";
+            ++oversubscribed;
+        }
+        os << "\n";
+        for (const auto& publication : link_p.second.publications)
+            os << "    " << publication << "\n";
+    }
+    os << std::flush;
+    return oversubscribed;
+}
+
+// Writes the interthread publish() and subscribe() calls that copy the data (see
+// PubSubEntry::copies) with the bytes per second they copy, the size of the type times the rate of
+// the call (or of the messages received), largest first
+void write_copy_report(std::ostream& os, const viz::Deployment& deployment, const RateModel& rates)
+{
+    struct Copy
+    {
+        Rate bytes_per_second;
+        std::string description;
+    };
+    std::vector<Copy> copies;
+
+    auto describe = [](const viz::Platform& platform, const viz::Application& application,
+                       const PubSubEntry& e, const std::string& action, Rate rate) {
+        return platform.name + "/" + application.name + "/" + e.thread.str() + " " + action +
+               " " + e.group.str() + " (" + e.type.str() + ", " + std::to_string(e.size) +
+               " bytes) at " + (rate.lower_bound ? ">=" : "") + format_number(rate.hz) +
+               " msg/s";
+    };
+
+    for (const auto& platform : deployment.platforms)
+    {
+        for (const auto& application : platform.applications)
+        {
+            // merged, since a base thread publishes and subscribes as its most derived thread
+            std::set<PubSubEntry> pubs, subs;
+            for (const auto& thread_p : application->threads)
             {
-                const auto& thread = thread_p.second;
-
-                std::string thread_display_name = thread->most_derived_name();
-                using boost::algorithm::replace_all;
-                replace_all(thread_display_name, "&", "&amp;");
-                replace_all(thread_display_name, "\"", "&quot;");
-                replace_all(thread_display_name, "\'", "&apos;");
-                replace_all(thread_display_name, "<", "&lt;");
-                replace_all(thread_display_name, ">", "&gt;");
-
-                boost::algorithm::replace_first(thread_display_name, "&lt;", "<br/>&lt;");
-                replace_all(thread_display_name, "&lt;", "<font point-size=\"10\">&lt;");
-                replace_all(thread_display_name, "&gt;", "&gt;</font>");
-                
-                replace_all(thread_display_name, ", ", ",<br/>");
-
-                ofs << "\t\t\t"
-                    << node_name(platform.name, application.name, thread->most_derived_name())
-                    << " [label=<" << thread_display_name << ">,fontcolor=" << thread_color
-                    << ",shape=box]\n";
-
-                write_thread_connections(ofs, platform, application, *thread,
-                                         thread_disconnected_subs);
+                for (const auto& pub : thread_p.second->interthread_publishes)
+                    goby::clang::insert_merged(pubs, pub);
+                for (const auto& sub : thread_p.second->interthread_subscribes)
+                    goby::clang::insert_merged(subs, sub);
             }
 
-            for (const auto& sub : thread_disconnected_subs)
+            for (const auto& pub : pubs)
             {
-                ofs << "\t\t\t"
-                    << disconnected_subscription(platform.name, application.name, sub, thread_color)
-                    << "\n";
+                if (pub.size < 0)
+                    continue;
+                for (const auto& site : pub.copies)
+                {
+                    auto rate = rates.get(platform, *application, pub, site);
+                    copies.push_back({Rate{pub.size * rate.hz, rate.lower_bound},
+                                      describe(platform, *application, pub, "publishes", rate) +
+                                          " by const reference at " + site});
+                }
             }
 
-            ofs << "\t\t}\n";
+            for (const auto& sub : subs)
+            {
+                if (sub.size < 0)
+                    continue;
+                auto rate = rates.received_rate(platform, *application, sub);
+                for (const auto& site : sub.copies)
+                    copies.push_back({Rate{sub.size * rate.hz, rate.lower_bound},
+                                      describe(platform, *application, sub, "receives", rate) +
+                                          " by value at " + site});
+            }
+        }
+    }
+
+    std::stable_sort(copies.begin(), copies.end(), [](const Copy& a, const Copy& b) {
+        return a.bytes_per_second.hz > b.bytes_per_second.hz;
+    });
+
+    os << "Avoidable interthread copies of deployment " << deployment.name
+       << " (largest first):\n";
+    for (const auto& copy : copies)
+        os << "  " << (copy.bytes_per_second.lower_bound ? ">=" : "")
+           << format_number(copy.bytes_per_second.hz) << " bytes/s: " << copy.description << "\n";
+    os << std::flush;
+}
 
-            write_process_connections(ofs, platform, application, process_disconnected_subs);
+#ifdef __linux__
+// Watches a set of files through inotify on their directories, so that files replaced by a rename
+// (as many generators do) are seen as well as those written in place
+class FileWatcher
+{
+  public:
+    FileWatcher(const std::set<std::string>& files) : fd_(inotify_init1(IN_CLOEXEC))
+    {
+        if (fd_ < 0)
+        {
+            std::cerr << "Failed to initialize inotify: " << std::strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
         }
 
-        for (const auto& sub_p : process_disconnected_subs)
+        std::map<std::string, int> directory_watches;
+        for (const auto& file : files)
         {
-            for (const auto& sub : sub_p.second)
+            auto slash = file.rfind('/');
+            std::string directory = slash == std::string::npos ? "." : file.substr(0, slash);
+            auto it = directory_watches.find(directory);
+            if (it == directory_watches.end())
             {
-                ofs << "\t\t\t"
-                    << disconnected_subscription(platform.name, sub_p.first, sub, process_color)
-                    << "\n";
+                int wd = inotify_add_watch(fd_, directory.c_str(),
+                                           IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+                if (wd < 0)
+                {
+                    std::cerr << "Failed to watch " << directory << ": " << std::strerror(errno)
+                              << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                it = directory_watches.emplace(directory, wd).first;
+                prefixes_[wd] = slash == std::string::npos ? "" : directory + "/";
             }
+            files_.insert(file);
         }
+    }
+    ~FileWatcher() { close(fd_); }
 
-        ofs << "\t}\n";
+    // block until a watched file changes, then until there have been no more events for
+    // settle_ms (a build usually writes many interface files in a row)
+    void wait(int settle_ms = 200)
+    {
+        bool changed = false;
+        while (!changed || poll_events(settle_ms))
+        {
+            if (read_events())
+                changed = true;
+        }
+    }
 
-        for (const auto& application : platform.applications)
-            write_vehicle_connections(ofs, deployment, platform, application,
-                                      platform_disconnected_subs);
+  private:
+    bool poll_events(int timeout_ms)
+    {
+        pollfd fd{fd_, POLLIN, 0};
+        return poll(&fd, 1, timeout_ms) > 0;
     }
 
-    for (const auto& sub_plat_p : platform_disconnected_subs)
+    // true if any of the events read is for a watched file
+    bool read_events()
     {
-        for (const auto& sub_app_p : sub_plat_p.second)
+        alignas(inotify_event) char buffer[4096];
+        auto length = read(fd_, buffer, sizeof(buffer));
+        if (length < 0)
         {
-            for (const auto& sub : sub_app_p.second)
+            if (errno == EINTR)
+                return false;
+            std::cerr << "Failed to read inotify events: " << std::strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        bool watched = false;
+        for (char* p = buffer; p < buffer + length;)
+        {
+            const auto* event = reinterpret_cast<const inotify_event*>(p);
+            if (event->len && files_.count(prefixes_[event->wd] + event->name))
+                watched = true;
+            p += sizeof(inotify_event) + event->len;
+        }
+        return watched;
+    }
+
+    int fd_;
+    // watch descriptor to the directory prefix of the files in it
+    std::map<int, std::string> prefixes_;
+    std::set<std::string> files_;
+};
+#endif
+
+int goby::clang::visualize(const std::vector<std::string>& yamls, std::string output_directory,
+                           std::string output_file, std::string deployment_config_input,
+                           const VisualizeOptions& options)
+{
+    g_omit_disconnected = options.omit_disconnected;
+
+    // the DCCL messages are loaded once, even with -watch
+    std::unique_ptr<DcclSizes> dccl_sizes;
+    if (options.bandwidth_report)
+        dccl_sizes.reset(new DcclSizes(options.dccl_libraries));
+
+    auto render = [&](const viz::PlatformYamls& platform_yamls, const std::string& deployment_name,
+                      viz::ApplicationCache& application_cache,
+                      viz::CollapsedApplications& collapsed_applications,
+                      FragmentCache* fragments) -> std::string {
+        if (!application_cache.load(viz::interface_files(platform_yamls), options.jobs))
+            return std::string();
+
+        viz::Deployment deployment(deployment_name, platform_yamls, application_cache);
+        auto group_rates = read_rates(options.rates_file);
+        if (dccl_sizes || options.copy_report)
+        {
+            // for the platforms and threads themselves, so before collapsing
+            RateModel rates(deployment, group_rates);
+            if (dccl_sizes)
             {
-                ofs << "\t\t\t"
-                    << disconnected_subscription(sub_plat_p.first, sub_app_p.first, sub,
-                                                 vehicle_color)
-                    << "\n";
+                auto oversubscribed = write_bandwidth_report(std::cout, deployment, rates,
+                                                             *dccl_sizes, options.link_capacity);
+                if (oversubscribed > 0)
+                    std::cerr << "Warning: " << oversubscribed
+                              << " intervehicle link(s) of deployment " << deployment.name
+                              << " exceed the link capacity of "
+                              << format_number(options.link_capacity) << " bits/s" << std::endl;
             }
+            if (options.copy_report)
+                write_copy_report(std::cout, deployment, rates);
         }
-    }
 
-    ofs << "}\n";
+        if (options.collapse)
+        {
+            deployment = viz::collapse(deployment, collapsed_applications);
 
-    return 0;
+            // forget the applications that are no longer loaded (changed or removed)
+            for (auto it = collapsed_applications.begin(); it != collapsed_applications.end();)
+            {
+                if (it->first.use_count() == 1)
+                    it = collapsed_applications.erase(it);
+                else
+                    ++it;
+            }
+        }
+        return write_graph(deployment, RateModel(deployment, group_rates), output_directory,
+                           output_file, options, fragments);
+    };
+
+    viz::ApplicationCache application_cache;
+    viz::CollapsedApplications collapsed_applications;
+    if (!options.watch)
+    {
+        std::string deployment_name;
+        viz::PlatformYamls platform_yamls;
+        read_deployment(yamls, deployment_config_input, deployment_name, platform_yamls);
+        if (render(platform_yamls, deployment_name, application_cache, collapsed_applications,
+                   nullptr)
+                .empty())
+            exit(EXIT_FAILURE);
+        return 0;
+    }
+
+#ifdef __linux__
+    // the parsed applications and the text of their clusters are kept between renders, so each
+    // render only parses and writes the applications whose interface files changed
+    FragmentCache fragments;
+    for (;;)
+    {
+        std::string deployment_name;
+        viz::PlatformYamls platform_yamls;
+        read_deployment(yamls, deployment_config_input, deployment_name, platform_yamls);
+
+        // watch from before loading so that no change is missed
+        auto watched = viz::interface_files(platform_yamls);
+        if (deployment_config_input.empty())
+            watched.insert(yamls.at(0));
+        if (!options.rates_file.empty())
+            watched.insert(options.rates_file);
+        FileWatcher watcher(watched);
+
+        auto file_name = render(platform_yamls, deployment_name, application_cache,
+                                collapsed_applications, &fragments);
+        auto reused = fragments.prune();
+        if (!file_name.empty())
+            std::cout << "Wrote " << file_name << " (parsed " << application_cache.parsed()
+                      << " of " << application_cache.size() << " interface files, reused "
+                      << reused << " application clusters)" << std::endl;
+
+        watcher.wait();
+    }
+#else
+    std::cerr << "-watch requires inotify (Linux)" << std::endl;
+    exit(EXIT_FAILURE);
+#endif
 }